@@ -0,0 +1,104 @@
+/**
+ * Micro-batching consumers: with a batch size, a consumer collects up to that many items,
+ * or as many as arrive within the linger time after the first one, and then processes the
+ * whole batch at the cost of a single sleep.
+ *
+ * The report shows how full the batches were and how long items waited in a batch before
+ * being processed, to weigh the latency added against the throughput gained.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "simulator.h"
+
+/**
+ * Collects a batch of items for a consumer, blocking until the first one arrives.
+ *
+ * @param consumer The consumer.
+ * @param queue The queue the consumer pops from.
+ * @param records Receives up to 'batch_size' items.
+ *
+ * @return The number of items collected (0 once the queue is closed).
+ */
+int collectBatch(Worker *consumer, Queue *queue, unsigned char *records)
+{
+    TestCase *test_case = consumer->test_case;
+    int count = queuePopBatch(queue, records, test_case->batch_size, NULL);
+
+    if (!count)
+        return 0;
+
+    long long first = now();
+    long long arrivals = 0; // The sum over the items collected of their arrival after the first pop.
+    long long limit = first + test_case->linger * 1000LL;
+    struct timespec deadline = {limit / 1000000000LL, limit % 1000000000LL};
+
+    while (count < test_case->batch_size) {
+        int popped = queuePopBatch(queue, records + (size_t)count * queue->item_size, test_case->batch_size - count, &deadline);
+
+        if (!popped)
+            break;
+
+        arrivals += (now() - first) * popped;
+        count += popped;
+    }
+
+    int bucket = 31 - __builtin_clz((unsigned int)count);
+
+    consumer->batches++;
+    consumer->full_batches += count == test_case->batch_size;
+    consumer->batch_sizes[bucket < BATCH_SIZE_BUCKETS ? bucket : BATCH_SIZE_BUCKETS - 1]++;
+    consumer->batch_wait += (now() - first) * count - arrivals;
+
+    return count;
+}
+
+/**
+ * Prints the sizes of the batches a test case's consumers processed, how long their items
+ * waited in them and the consumers' throughput.
+ *
+ * @param test_case The finished test case, with a batch size.
+ */
+void reportBatches(TestCase *test_case)
+{
+    unsigned long sizes[BATCH_SIZE_BUCKETS] = {0};
+    unsigned long batches = 0;
+    unsigned long full = 0;
+    unsigned long items = 0;
+    unsigned long processed = 0;
+    long long wait = 0;
+    double elapsed = (now() - test_case->started) / 1e9;
+
+    for (int i = test_case->num_producers; i < test_case->num_workers; i++) {
+        Worker *consumer = &test_case->workers[i];
+
+        for (int bucket = 0; bucket < BATCH_SIZE_BUCKETS; bucket++)
+            sizes[bucket] += consumer->batch_sizes[bucket];
+
+        batches += consumer->batches;
+        full += consumer->full_batches;
+        items += consumer->operations + consumer->expired;
+        processed += consumer->operations;
+        wait += consumer->batch_wait;
+    }
+
+    printf("\tBatches: size = %d, linger = %d us, batches = %lu, mean size = %.2f, full = %.1f%%, sizes =", test_case->batch_size, test_case->linger,
+           batches, batches ? (double)items / batches : 0, batches ? 100.0 * full / batches : 0);
+
+    for (int bucket = 0; bucket < BATCH_SIZE_BUCKETS; bucket++) {
+        if (!sizes[bucket])
+            continue;
+
+        if (bucket == 0)
+            printf(" 1: %lu", sizes[bucket]);
+        else
+            printf(" %d-%d: %lu", 1 << bucket, (1 << (bucket + 1)) - 1, sizes[bucket]);
+    }
+
+    printf(", wait added = %.3f ms per item, throughput = %.1f items/s\n", items ? wait / 1e6 / items : 0, processed / elapsed);
+}
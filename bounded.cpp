@@ -0,0 +1,220 @@
+/**
+ * The simulator's template mode: runs a test case's producers and consumers against the
+ * pcq::BoundedQueue instantiation matching the test case (see bounded_queue.hpp).
+ *
+ * The concurrency policies follow the number of producers and consumers, the capacity is
+ * BSIZE rounded up to a power of two, and the wait policy is chosen on the command line.
+ * The threads run flat out (the sleep durations are ignored) for the test case's duration,
+ * after which the items left in the queue are moved to the test case's buffer so that the
+ * usual verification accounts for them.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "simulator.h"
+
+namespace {
+
+constexpr std::size_t MAX_CAPACITY = 4096;
+
+struct Mode
+{
+    int test_case_number;
+    int duration;
+    int num_producers;
+    int num_consumers;
+    TestCase *test_case;
+};
+
+template <typename Bounded>
+void producer(Bounded &queue, Worker *worker, unsigned int seed)
+{
+    TestCase *test_case = worker->test_case;
+
+    while (!__atomic_load_n(&test_case->terminated, __ATOMIC_RELAXED)) {
+        Item item = {rand_r(&seed) % 201, worker->id, worker->sequence, 0, 0, now(), 0, sizeof(Item)};
+
+        if (!queue.push(item))
+            break;
+
+        worker->sequence++;
+        __atomic_add_fetch(&worker->operations, 1, __ATOMIC_RELAXED);
+    }
+}
+
+template <typename Bounded>
+void consumer(Bounded &queue, Worker *worker)
+{
+    TestCase *test_case = worker->test_case;
+    Item item;
+
+    while (!__atomic_load_n(&test_case->terminated, __ATOMIC_RELAXED)) {
+        if (!queue.pop(item))
+            break;
+
+        recordItem(worker, item);
+        __atomic_add_fetch(&worker->operations, 1, __ATOMIC_RELAXED);
+    }
+}
+
+template <typename Producer, typename Consumer, typename Wait, std::size_t Capacity>
+void run(const Mode &mode)
+{
+    using Bounded = pcq::BoundedQueue<Item, Capacity, Producer, Consumer, Wait>;
+
+    TestCase *test_case = mode.test_case;
+    std::unique_ptr<Bounded> queue(new Bounded());
+    std::vector<std::thread> threads;
+
+    printf("\tqueue = BoundedQueue<Item, %zu, %s, %s, %s>\n", Capacity, Producer::name, Consumer::name, Wait::name);
+
+    if (!initWorkers(test_case, mode.num_producers, mode.num_consumers))
+        return;
+
+    if (!queueInit(&test_case->queue, findEngine("mutex"), (int)Capacity, sizeof(Item), NULL)) {
+        freeWorkers(test_case);
+        return;
+    }
+
+    for (int i = 0; i < test_case->num_workers; i++) {
+        Worker *worker = &test_case->workers[i];
+
+        if (worker->is_producer)
+            threads.emplace_back(producer<Bounded>, std::ref(*queue), worker, deriveSeed(test_case->seed, worker, RANDOM_ITEMS));
+        else
+            threads.emplace_back(consumer<Bounded>, std::ref(*queue), worker);
+    }
+
+    pthread_condattr_t done_flag_attr;
+    pthread_condattr_init(&done_flag_attr);
+    pthread_condattr_setclock(&done_flag_attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&test_case->done_lock, nullptr);
+    pthread_cond_init(&test_case->done_flag, &done_flag_attr);
+    pthread_condattr_destroy(&done_flag_attr);
+
+    watchTestCase(test_case);
+
+    // Wait out the test case, unless SIGINT stops it early.
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += mode.duration;
+
+    pthread_mutex_lock(&test_case->done_lock);
+    while (!test_case->terminated && pthread_cond_timedwait(&test_case->done_flag, &test_case->done_lock, &deadline) != ETIMEDOUT);
+    __atomic_store_n(&test_case->terminated, true, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&test_case->done_lock);
+    queue->close();
+
+    for (std::thread &thread : threads)
+        thread.join();
+
+    watchTestCase(nullptr);
+    pthread_mutex_destroy(&test_case->done_lock);
+    pthread_cond_destroy(&test_case->done_flag);
+
+    double elapsed = (now() - test_case->started) / 1e9;
+    unsigned long moved = 0;
+    Item item;
+
+    for (int i = mode.num_producers; i < test_case->num_workers; i++)
+        moved += test_case->workers[i].operations;
+
+    while (queue->tryPop(item))
+        queuePush(&test_case->queue, &item);
+
+    printf("\tThroughput: %lu items in %.2f s (%.3f Mitems/s)\n", moved, elapsed, moved / elapsed / 1e6);
+
+    verify(test_case);
+    freeWorkers(test_case);
+    queueDestroy(&test_case->queue);
+}
+
+/**
+ * Instantiates the smallest power of two capacity that holds 'capacity' items.
+ */
+template <typename Producer, typename Consumer, typename Wait, std::size_t Capacity = 2>
+bool withCapacity(std::size_t capacity, const Mode &mode)
+{
+    if constexpr (Capacity > MAX_CAPACITY) {
+        return false;
+    } else {
+        if (capacity > Capacity)
+            return withCapacity<Producer, Consumer, Wait, Capacity * 2>(capacity, mode);
+
+        run<Producer, Consumer, Wait, Capacity>(mode);
+
+        return true;
+    }
+}
+
+template <typename Wait>
+bool withWait(const Mode &mode)
+{
+    std::size_t capacity = mode.test_case->BSIZE;
+    bool single_producer = mode.num_producers == 1;
+    bool single_consumer = mode.num_consumers == 1;
+
+    if (single_producer && single_consumer)
+        return withCapacity<pcq::SingleProducer, pcq::SingleConsumer, Wait>(capacity, mode);
+    if (single_producer)
+        return withCapacity<pcq::SingleProducer, pcq::MultiConsumer, Wait>(capacity, mode);
+    if (single_consumer)
+        return withCapacity<pcq::MultiProducer, pcq::SingleConsumer, Wait>(capacity, mode);
+
+    return withCapacity<pcq::MultiProducer, pcq::MultiConsumer, Wait>(capacity, mode);
+}
+
+} // namespace
+
+/**
+ * Executes a test case against a pcq::BoundedQueue.
+ *
+ * @param test_case_number The current test case number.
+ * @param duration The duration of the test case in seconds.
+ * @param num_producers The number of producers.
+ * @param num_consumers The number of consumers.
+ * @param test_case The structure holding the test case parameters.
+ * @param wait The wait policy: "spin", "yield" or "block".
+ *
+ * @return Whether the test case could be run.
+ */
+bool executeTemplate(int test_case_number, int duration, int num_producers, int num_consumers, TestCase *test_case, const char *wait)
+{
+    Mode mode = {test_case_number, duration, num_producers, num_consumers, test_case};
+    bool ran;
+
+    printf("Test Case %d\n", test_case_number);
+    printf("\tbufferSize = %d, num_producers = %d, num_consumers = %d, wait = %s \n", test_case->BSIZE, num_producers, num_consumers, wait);
+
+    if (num_producers < 1 || num_consumers < 1 || test_case->BSIZE < 1) {
+        fprintf(stderr, "Test Case %d: the template mode needs a producer, a consumer and a positive BSIZE.\n", test_case_number);
+        return false;
+    }
+
+    if (strcmp(wait, "spin") == 0)
+        ran = withWait<pcq::SpinWait>(mode);
+    else if (strcmp(wait, "yield") == 0)
+        ran = withWait<pcq::YieldWait>(mode);
+    else if (strcmp(wait, "block") == 0)
+        ran = withWait<pcq::BlockingWait>(mode);
+    else {
+        fprintf(stderr, "Unknown wait policy '%s' (expected spin, yield or block).\n", wait);
+        return false;
+    }
+
+    if (!ran)
+        fprintf(stderr, "Test Case %d: the template mode supports a BSIZE of at most %zu.\n", test_case_number, MAX_CAPACITY);
+
+    return ran;
+}
@@ -0,0 +1,384 @@
+/**
+ * A header-only bounded queue whose element type, capacity, concurrency and wait strategy
+ * are compile-time parameters:
+ *
+ *   pcq::BoundedQueue<T, Capacity, ProducerPolicy, ConsumerPolicy, WaitPolicy>
+ *
+ * Capacity must be a power of two (of at least 2) so that a slot is found by masking the
+ * 64-bit head and tail counters, which only ever grow. ProducerPolicy is SingleProducer or
+ * MultiProducer, ConsumerPolicy is SingleConsumer or MultiConsumer, and WaitPolicy is
+ * SpinWait, YieldWait or BlockingWait. Each combination compiles to its own code path:
+ *
+ *  - SPSC: the producer owns the tail and the consumer owns the head; a slot is published
+ *    by storing the counter that follows it (Lamport's ring).
+ *  - Any other combination: each slot carries a sequence number telling whether it is
+ *    free or full for a given lap (Vyukov's bounded queue). A "multi" side claims a
+ *    counter value with a compare-and-swap, a "single" side with a plain store.
+ *
+ * Like the simulator's engines, 'push' and 'pop' block (according to WaitPolicy) while
+ * the queue is full (or empty). Once the queue is closed, pushes fail and pops fail as
+ * soon as the queue is empty.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace pcq {
+
+struct SingleProducer
+{
+    static constexpr bool single = true;
+    static constexpr const char *name = "SingleProducer";
+};
+
+struct MultiProducer
+{
+    static constexpr bool single = false;
+    static constexpr const char *name = "MultiProducer";
+};
+
+struct SingleConsumer
+{
+    static constexpr bool single = true;
+    static constexpr const char *name = "SingleConsumer";
+};
+
+struct MultiConsumer
+{
+    static constexpr bool single = false;
+    static constexpr const char *name = "MultiConsumer";
+};
+
+/**
+ * Tells the CPU that the calling thread is spinning.
+ */
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * Busy-waits: lowest latency, but burns a CPU per waiting thread.
+ */
+struct SpinWait
+{
+    static constexpr const char *name = "SpinWait";
+
+    template <typename Ready>
+    void wait(Ready ready)
+    {
+        while (!ready())
+            cpuRelax();
+    }
+
+    void notify() {}
+    void notifyAll() {}
+};
+
+/**
+ * Gives up the CPU between checks.
+ */
+struct YieldWait
+{
+    static constexpr const char *name = "YieldWait";
+
+    template <typename Ready>
+    void wait(Ready ready)
+    {
+        while (!ready())
+            std::this_thread::yield();
+    }
+
+    void notify() {}
+    void notifyAll() {}
+};
+
+/**
+ * Sleeps on a condition variable. Notifying is free while nobody waits: a waiter registers
+ * itself before checking the condition, and a notifier checks for waiters after changing
+ * the state, with a full fence on both sides so that one of them sees the other.
+ */
+class BlockingWait
+{
+public:
+    static constexpr const char *name = "BlockingWait";
+
+    template <typename Ready>
+    void wait(Ready ready)
+    {
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            flag_.wait(guard, ready);
+        }
+
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (waiters_.load(std::memory_order_relaxed) == 0)
+            return;
+
+        std::lock_guard<std::mutex> guard(lock_);
+        flag_.notify_one();
+    }
+
+    void notifyAll()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (waiters_.load(std::memory_order_relaxed) == 0)
+            return;
+
+        std::lock_guard<std::mutex> guard(lock_);
+        flag_.notify_all();
+    }
+
+private:
+    std::mutex lock_;
+    std::condition_variable flag_;
+    std::atomic<int> waiters_{0};
+};
+
+template <typename T, std::size_t Capacity, typename ProducerPolicy, typename ConsumerPolicy, typename WaitPolicy>
+class BoundedQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two of at least 2");
+
+    static constexpr bool spsc = ProducerPolicy::single && ConsumerPolicy::single;
+    static constexpr std::uint64_t mask = Capacity - 1;
+    static constexpr std::size_t line = 64; // The size of a cache line.
+
+    struct PlainSlot
+    {
+        T value;
+    };
+
+    // 'sequence' is the slot's index plus Capacity times the lap while the slot is free,
+    // and one more than that once it holds an item.
+    struct SequencedSlot
+    {
+        std::atomic<std::uint64_t> sequence;
+        T value;
+    };
+
+    using Slot = typename std::conditional<spsc, PlainSlot, SequencedSlot>::type;
+
+public:
+    using value_type = T;
+    using producer_policy = ProducerPolicy;
+    using consumer_policy = ConsumerPolicy;
+    using wait_policy = WaitPolicy;
+
+    BoundedQueue()
+    {
+        if constexpr (!spsc) {
+            for (std::size_t i = 0; i < Capacity; i++)
+                slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    static constexpr std::size_t capacity()
+    {
+        return Capacity;
+    }
+
+    /**
+     * The number of items in the queue (a snapshot, exact once no thread pushes or pops).
+     */
+    std::size_t size() const
+    {
+        std::uint64_t head = head_.load(std::memory_order_acquire);
+        std::uint64_t tail = tail_.load(std::memory_order_acquire);
+
+        if (tail <= head)
+            return 0;
+
+        return tail - head < Capacity ? tail - head : Capacity;
+    }
+
+    bool closed() const
+    {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Closes the queue and wakes every waiting thread.
+     */
+    void close()
+    {
+        closed_.store(true, std::memory_order_seq_cst);
+        notFull_.notifyAll();
+        notEmpty_.notifyAll();
+    }
+
+    /**
+     * Appends an item unless the queue is full.
+     */
+    bool tryPush(const T &value)
+    {
+        if constexpr (spsc) {
+            std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+
+            if (tail - head_.load(std::memory_order_acquire) == Capacity)
+                return false;
+
+            slots_[tail & mask].value = value;
+            tail_.store(tail + 1, std::memory_order_release);
+        } else if constexpr (ProducerPolicy::single) {
+            std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+            Slot &slot = slots_[tail & mask];
+
+            if (slot.sequence.load(std::memory_order_acquire) != tail)
+                return false;
+
+            slot.value = value;
+            slot.sequence.store(tail + 1, std::memory_order_release);
+            tail_.store(tail + 1, std::memory_order_release);
+        } else {
+            std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+            Slot *slot;
+
+            for (;;) {
+                slot = &slots_[tail & mask];
+                std::int64_t lag = (std::int64_t)(slot->sequence.load(std::memory_order_acquire) - tail);
+
+                if (lag == 0) {
+                    if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+                        break;
+                } else if (lag < 0) {
+                    return false; // The slot still holds the item of the previous lap.
+                } else {
+                    tail = tail_.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->value = value;
+            slot->sequence.store(tail + 1, std::memory_order_release);
+        }
+
+        notEmpty_.notify();
+
+        return true;
+    }
+
+    /**
+     * Removes the first item unless the queue is empty.
+     */
+    bool tryPop(T &value)
+    {
+        if constexpr (spsc) {
+            std::uint64_t head = head_.load(std::memory_order_relaxed);
+
+            if (head == tail_.load(std::memory_order_acquire))
+                return false;
+
+            value = slots_[head & mask].value;
+            head_.store(head + 1, std::memory_order_release);
+        } else if constexpr (ConsumerPolicy::single) {
+            std::uint64_t head = head_.load(std::memory_order_relaxed);
+            Slot &slot = slots_[head & mask];
+
+            if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+                return false;
+
+            value = slot.value;
+            slot.sequence.store(head + Capacity, std::memory_order_release);
+            head_.store(head + 1, std::memory_order_release);
+        } else {
+            std::uint64_t head = head_.load(std::memory_order_relaxed);
+            Slot *slot;
+
+            for (;;) {
+                slot = &slots_[head & mask];
+                std::int64_t lag = (std::int64_t)(slot->sequence.load(std::memory_order_acquire) - (head + 1));
+
+                if (lag == 0) {
+                    if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed))
+                        break;
+                } else if (lag < 0) {
+                    return false; // The slot has not been filled in this lap yet.
+                } else {
+                    head = head_.load(std::memory_order_relaxed);
+                }
+            }
+
+            value = slot->value;
+            slot->sequence.store(head + Capacity, std::memory_order_release);
+        }
+
+        notFull_.notify();
+
+        return true;
+    }
+
+    /**
+     * Appends an item, waiting while the queue is full.
+     *
+     * @return Whether the item was pushed (false once the queue is closed).
+     */
+    bool push(const T &value)
+    {
+        while (!closed()) {
+            if (tryPush(value))
+                return true;
+
+            notFull_.wait([this] { return closed() || size() < Capacity; });
+        }
+
+        return false;
+    }
+
+    /**
+     * Removes the first item, waiting while the queue is empty.
+     *
+     * @return Whether an item was popped (false once the queue is closed and empty).
+     */
+    bool pop(T &value)
+    {
+        for (;;) {
+            if (tryPop(value))
+                return true;
+
+            if (closed())
+                return tryPop(value);
+
+            notEmpty_.wait([this] { return closed() || size() > 0; });
+        }
+    }
+
+private:
+    alignas(line) std::atomic<std::uint64_t> tail_{0}; // Written by producers.
+    alignas(line) std::atomic<std::uint64_t> head_{0}; // Written by consumers.
+    alignas(line) std::atomic<bool> closed_{false};
+    WaitPolicy notFull_;
+    WaitPolicy notEmpty_;
+    alignas(line) Slot slots_[Capacity];
+};
+
+} // namespace pcq
+
+#endif // BOUNDED_QUEUE_HPP
@@ -0,0 +1,190 @@
+/**
+ * The simulator's clock: 'now' stamps every item pushed and popped and times every wait, so
+ * it must cost a small fraction of a ~50 ns handoff. 'clock_gettime' costs ~20 ns per call,
+ * so on x86-64 CPUs with an invariant TSC (one ticking at a constant rate in every power
+ * state, and in step on every core), 'now' reads the TSC instead and converts its ticks to
+ * nanoseconds with a multiplier calibrated against CLOCK_MONOTONIC at startup.
+ *
+ * The converted time is anchored to CLOCK_MONOTONIC, so that it can still be mixed with
+ * 'clock_gettime' and used as a deadline for 'clock_nanosleep' and the condition variables
+ * using that clock; it drifts from CLOCK_MONOTONIC only by the calibration's error (a few
+ * parts per million). Elsewhere, or when the TSC is not invariant, 'now' reads CLOCK_MONOTONIC.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "simulator.h"
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define CLOCK_TSC 1
+#endif
+
+#define CALIBRATION_MS 20      // How long the TSC is measured against CLOCK_MONOTONIC.
+#define CALIBRATION_SAMPLES 5  // The readings per calibration point, of which the tightest is kept.
+#define OVERHEAD_READINGS 100000 // The readings timed to measure the cost of each clock.
+
+static bool use_tsc = false;
+static uint64_t tsc_base;    // The TSC at the calibration's end...
+static long long mono_base;  // ...and the CLOCK_MONOTONIC time it corresponds to.
+static uint64_t tsc_mult;    // Nanoseconds per tick, as a fixed point number with 32 fractional bits.
+static double tsc_ghz;       // Ticks per nanosecond.
+static double tsc_cost;      // The cost of a reading of 'now' with the TSC, in nanoseconds.
+static double monotonic_cost; // The cost of a reading of CLOCK_MONOTONIC, in nanoseconds.
+
+/**
+ * Reads CLOCK_MONOTONIC.
+ *
+ * @return The current CLOCK_MONOTONIC time in nanoseconds.
+ */
+static long long monotonic(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Reads the clock: the calibrated TSC if available, CLOCK_MONOTONIC otherwise.
+ *
+ * @return The current CLOCK_MONOTONIC time in nanoseconds.
+ */
+long long now(void)
+{
+#ifdef CLOCK_TSC
+    if (use_tsc)
+        return mono_base + (long long)(((unsigned __int128)(__rdtsc() - tsc_base) * tsc_mult) >> 32);
+#endif
+
+    return monotonic();
+}
+
+#ifdef CLOCK_TSC
+/**
+ * Determines whether the CPU's TSC is invariant.
+ */
+static bool invariantTsc(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return false;
+
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+
+    return (edx >> 8) & 1;
+}
+
+/**
+ * Reads the TSC and CLOCK_MONOTONIC at (nearly) the same time, keeping the tightest of a few
+ * attempts: the TSC is read between two readings of CLOCK_MONOTONIC, and paired with their mean.
+ */
+static void readBoth(uint64_t *tsc, long long *mono)
+{
+    long long tightest = -1;
+
+    for (int i = 0; i < CALIBRATION_SAMPLES; i++) {
+        long long before = monotonic();
+        unsigned int core;
+        uint64_t ticks = __rdtscp(&core);
+        long long after = monotonic();
+
+        if (tightest < 0 || after - before < tightest) {
+            tightest = after - before;
+            *tsc = ticks;
+            *mono = before + (after - before) / 2;
+        }
+    }
+}
+#endif
+
+/**
+ * Measures the cost of a reading of the clock, in nanoseconds.
+ */
+static double readingCost(long long (*clock)(void))
+{
+    volatile long long sink = 0;
+    long long started = monotonic();
+
+    for (int i = 0; i < OVERHEAD_READINGS; i++)
+        sink += clock();
+
+    (void)sink;
+
+    return (double)(monotonic() - started) / OVERHEAD_READINGS;
+}
+
+/**
+ * Chooses the clock read by 'now', calibrating the TSC if it is chosen.
+ *
+ * Must be called before the calling process creates any producer or consumer thread.
+ *
+ * @param source "tsc", "monotonic" or "auto" (the TSC if it is invariant).
+ *
+ * @return Whether the source is known.
+ */
+bool initClock(const char *source)
+{
+    bool want_tsc = strcmp(source, "tsc") == 0;
+
+    if (!want_tsc && strcmp(source, "auto") != 0 && strcmp(source, "monotonic") != 0)
+        return false;
+
+    use_tsc = false;
+    monotonic_cost = readingCost(monotonic);
+
+#ifdef CLOCK_TSC
+    if (strcmp(source, "monotonic") == 0)
+        return true;
+
+    if (!invariantTsc()) {
+        if (want_tsc)
+            printf("Clock: the TSC is not invariant, using CLOCK_MONOTONIC\n");
+
+        return true;
+    }
+
+    uint64_t tsc_start;
+    long long mono_start;
+    struct timespec pause = {0, CALIBRATION_MS * 1000000L};
+
+    readBoth(&tsc_start, &mono_start);
+    nanosleep(&pause, NULL);
+    readBoth(&tsc_base, &mono_base);
+
+    if (tsc_base <= tsc_start || mono_base <= mono_start) {
+        printf("Clock: the TSC could not be calibrated, using CLOCK_MONOTONIC\n");
+        return true;
+    }
+
+    tsc_ghz = (double)(tsc_base - tsc_start) / (mono_base - mono_start);
+    tsc_mult = (uint64_t)(((unsigned __int128)(mono_base - mono_start) << 32) / (tsc_base - tsc_start));
+    use_tsc = true;
+    tsc_cost = readingCost(now);
+#else
+    if (want_tsc)
+        printf("Clock: no TSC on this CPU, using CLOCK_MONOTONIC\n");
+#endif
+
+    return true;
+}
+
+/**
+ * Prints the clock read by 'now' and the cost of its readings.
+ */
+void reportClock(void)
+{
+    if (use_tsc)
+        printf("Clock: tsc (%.3f GHz, %.1f ns per reading; CLOCK_MONOTONIC %.1f ns)\n", tsc_ghz, tsc_cost, monotonic_cost);
+    else
+        printf("Clock: monotonic (%.1f ns per reading)\n", monotonic_cost);
+}
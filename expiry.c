@@ -0,0 +1,186 @@
+/**
+ * Item expiry: with a TTL, every item is stamped with the time after which it is stale.
+ * Consumers discard stale items as soon as they pop them, without verifying their payload
+ * or sleeping, and an optional sweeper thread periodically removes the stale items waiting
+ * at the front of the buffer(s) so that consumers do not even pop them.
+ *
+ * Discarded and swept items are still recorded for verification; the report shows how
+ * many items expired and, through the latency of the items processed, how much sooner the
+ * fresh items got through.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "simulator.h"
+
+/**
+ * Determines whether an item is stale.
+ *
+ * @param test_case The test case.
+ * @param item The item.
+ * @param current_time The current CLOCK_MONOTONIC time in nanoseconds.
+ *
+ * @return Whether the test case has a TTL and the item's has passed.
+ */
+bool itemExpired(const TestCase *test_case, const Item *item, long long current_time)
+{
+    return test_case->ttl && item->expires && item->expires <= current_time;
+}
+
+/**
+ * Allocates the worker recording the items removed by a test case's sweeper.
+ *
+ * @param test_case The test case, whose producer and consumer workers are initialized.
+ *
+ * @return Whether the sweeper could be allocated.
+ */
+bool initSweeper(TestCase *test_case)
+{
+    Worker *sweeper = (Worker *)calloc(1, sizeof(Worker));
+
+    if (!sweeper || !(sweeper->seen = (Bitmap *)calloc(test_case->num_producers, sizeof(Bitmap)))) {
+        perror("calloc");
+        free(sweeper);
+        return false;
+    }
+
+    sweeper->test_case = test_case;
+    sweeper->id = -1;
+    test_case->sweeper = sweeper;
+
+    return true;
+}
+
+/**
+ * Releases the sweeper of a test case (and its bitmaps), if any.
+ *
+ * @param test_case The test case.
+ */
+void freeSweeper(TestCase *test_case)
+{
+    Worker *sweeper = test_case->sweeper;
+
+    if (!sweeper)
+        return;
+
+    for (int producer = 0; producer < test_case->num_producers; producer++)
+        free(sweeper->seen[producer].words);
+
+    free(sweeper->seen);
+    free(sweeper);
+    test_case->sweeper = NULL;
+}
+
+/**
+ * Records an item removed by the sweeper in the sweeper's bitmaps.
+ */
+static void recordSwept(Worker *sweeper, const Item *item)
+{
+    if (item->producer_id < 0 || item->producer_id >= sweeper->test_case->num_producers) {
+        sweeper->corrupt++;
+        return;
+    }
+
+    if (setBit(&sweeper->seen[item->producer_id], item->sequence))
+        sweeper->duplicates++;
+
+    sweeper->operations++;
+}
+
+/**
+ * The function used with the sweeper thread.
+ *
+ * Every 'sweep_interval' milliseconds until the test case is terminated, removes the
+ * expired items at the front of each of the test case's buffers.
+ *
+ * @param argv The test case to sweep.
+ */
+void *sweep(void *argv)
+{
+    TestCase *test_case = (TestCase *)argv;
+    Worker *sweeper = test_case->sweeper;
+    unsigned char *records = (unsigned char *)malloc(test_case->queue.item_size * test_case->BSIZE);
+
+    if (!records) {
+        perror("malloc");
+        pthread_exit(NULL);
+    }
+
+    pthread_mutex_lock(&(test_case->done_lock));
+
+    while (!test_case->terminated)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += test_case->sweep_interval / 1000;
+        deadline.tv_nsec += (test_case->sweep_interval % 1000) * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!test_case->terminated && pthread_cond_timedwait(&(test_case->done_flag), &(test_case->done_lock), &deadline) != ETIMEDOUT);
+
+        if (test_case->terminated)
+            break;
+
+        pthread_mutex_unlock(&(test_case->done_lock));
+
+        for (int q = 0; q < numTestCaseQueues(test_case); q++) {
+            Queue *queue = testCaseQueue(test_case, q);
+            int swept;
+
+            while ((swept = queueSweep(queue, records, test_case->BSIZE, now())) > 0) {
+                for (int i = 0; i < swept; i++) {
+                    Item item;
+
+                    memcpy(&item, records + (size_t)i * queue->item_size, sizeof(Item));
+                    recordSwept(sweeper, &item);
+                }
+
+                __atomic_add_fetch(&test_case->progress, swept, __ATOMIC_RELAXED);
+            }
+        }
+
+        pthread_mutex_lock(&(test_case->done_lock));
+    }
+
+    pthread_mutex_unlock(&(test_case->done_lock));
+    free(records);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Prints how many items of a test case expired, at dequeue and in the sweeper.
+ *
+ * @param test_case The finished test case, with a TTL.
+ */
+void reportExpiry(TestCase *test_case)
+{
+    unsigned long processed = 0;
+    unsigned long expired = 0;
+    unsigned long swept = test_case->sweeper ? test_case->sweeper->operations : 0;
+
+    for (int i = test_case->num_producers; i < test_case->num_workers; i++) {
+        processed += test_case->workers[i].operations;
+        expired += test_case->workers[i].expired;
+    }
+
+    unsigned long total = processed + expired + swept;
+
+    printf("\tExpiry: ttl = %lld ms, processed = %lu, expired at dequeue = %lu, swept = %lu", test_case->ttl / 1000000, processed, expired, swept);
+
+    if (test_case->sweeper)
+        printf(" (every %d ms)", test_case->sweep_interval);
+
+    printf(", stale = %.1f%%\n", total ? 100.0 * (expired + swept) / total : 0);
+}
@@ -0,0 +1,231 @@
+/**
+ * Fault injection: a test case may inject one fault for a window of its run, and then reports
+ * how the buffer and the latency reacted and how long they took to recover.
+ *
+ * The faults are the usual ways production queues misbehave: the first consumer freezes
+ * (as if stalled on garbage collection or I/O), the first producer bursts (producing the
+ * given factor faster, or without sleeping at all), or the first consumer slows down by the
+ * given factor.
+ *
+ * While the test case runs, a sampler thread records the depth of the buffer(s) every few
+ * milliseconds, and consumers record the latency of the items pushed before, during and
+ * after the fault separately. The report gives the depth before the fault and at its peak,
+ * the time after the fault until the depth was back to its level before the fault, and the
+ * latency of each phase.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "simulator.h"
+
+#define FAULT_SAMPLE_MS 10 // How often the sampler records the depth of the buffer(s).
+
+/**
+ * Names a fault.
+ *
+ * @param fault The fault.
+ *
+ * @return Its name, as given by the 'fault' option.
+ */
+const char *faultName(FaultKind fault)
+{
+    static const char *names[] = {"none", "freeze", "burst", "slow"};
+
+    return names[fault];
+}
+
+/**
+ * Determines whether a test case's fault is in effect.
+ *
+ * @param test_case The test case.
+ * @param time A CLOCK_MONOTONIC time in nanoseconds.
+ *
+ * @return Whether the test case injects a fault and the time falls within its window.
+ */
+bool faultActive(const TestCase *test_case, long long time)
+{
+    return faultPhase(test_case, time) == FAULT_DURING;
+}
+
+/**
+ * Places a time relative to a test case's fault.
+ *
+ * @param test_case The test case, which injects a fault.
+ * @param time A CLOCK_MONOTONIC time in nanoseconds.
+ *
+ * @return Whether the time is before, during or after the fault's window.
+ */
+FaultPhase faultPhase(const TestCase *test_case, long long time)
+{
+    long long start = test_case->started + test_case->fault_at;
+
+    if (!test_case->fault || time < start)
+        return FAULT_BEFORE;
+
+    return time < start + test_case->fault_for ? FAULT_DURING : FAULT_AFTER;
+}
+
+/**
+ * Allocates the depth samples of a test case injecting a fault.
+ *
+ * @param test_case The test case.
+ * @param duration The duration of the test case in seconds.
+ *
+ * @return Whether the samples could be allocated.
+ */
+bool initFault(TestCase *test_case, int duration)
+{
+    test_case->max_depth_samples = duration * 1000 / FAULT_SAMPLE_MS + 1;
+    test_case->num_depth_samples = 0;
+    test_case->depth_samples = (int *)malloc(sizeof(int) * test_case->max_depth_samples);
+
+    if (!test_case->depth_samples) {
+        perror("malloc");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Releases the depth samples of a test case.
+ *
+ * @param test_case The test case.
+ */
+void freeFault(TestCase *test_case)
+{
+    free(test_case->depth_samples);
+    test_case->depth_samples = NULL;
+}
+
+/**
+ * Freezes a consumer until its test case's fault is over (or the test case is terminated).
+ *
+ * @param worker The consumer.
+ */
+void freezeWorker(Worker *worker)
+{
+    TestCase *test_case = worker->test_case;
+    long long end = test_case->started + test_case->fault_at + test_case->fault_for;
+    struct timespec deadline = {end / 1000000000LL, end % 1000000000LL};
+
+    setWorkerState(worker, WORKER_SLEEPING, QUEUE_LOCK_NONE);
+
+    pthread_mutex_lock(&(test_case->done_lock));
+    while (!test_case->terminated && pthread_cond_timedwait(&(test_case->done_flag), &(test_case->done_lock), &deadline) != ETIMEDOUT);
+    pthread_mutex_unlock(&(test_case->done_lock));
+
+    setWorkerState(worker, WORKER_RUNNING, QUEUE_LOCK_NONE);
+}
+
+/**
+ * The function used with the depth sampler thread.
+ *
+ * Every FAULT_SAMPLE_MS milliseconds until the test case is terminated, records the number
+ * of items in its buffer(s).
+ *
+ * @param argv The test case to sample.
+ */
+void *sampleDepth(void *argv)
+{
+    TestCase *test_case = (TestCase *)argv;
+    long long next = test_case->started;
+
+    pthread_mutex_lock(&(test_case->done_lock));
+
+    while (!test_case->terminated && test_case->num_depth_samples < test_case->max_depth_samples)
+    {
+        next += FAULT_SAMPLE_MS * 1000000LL;
+
+        struct timespec deadline = {next / 1000000000LL, next % 1000000000LL};
+
+        while (!test_case->terminated && pthread_cond_timedwait(&(test_case->done_flag), &(test_case->done_lock), &deadline) != ETIMEDOUT);
+
+        if (test_case->terminated)
+            break;
+
+        int depth = 0;
+
+        for (int q = 0; q < numTestCaseQueues(test_case); q++) {
+            int size = queueSize(testCaseQueue(test_case, q));
+
+            depth += size > 0 ? size : 0;
+        }
+
+        test_case->depth_samples[test_case->num_depth_samples++] = depth;
+    }
+
+    pthread_mutex_unlock(&(test_case->done_lock));
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Prints how a test case's buffer and latency reacted to its fault.
+ *
+ * @param test_case The finished test case, which injected a fault.
+ */
+void reportFault(TestCase *test_case)
+{
+    static const char *phases[] = {"before", "during", "after"};
+
+    int start = (int)(test_case->fault_at / 1000000 / FAULT_SAMPLE_MS);
+    int end = (int)((test_case->fault_at + test_case->fault_for) / 1000000 / FAULT_SAMPLE_MS);
+    int baseline = 0;  // The deepest the buffer got before the fault.
+    int peak = 0;      // The deepest it got during and after the fault.
+    int peak_sample = start;
+    int recovered = -1; // The first sample after the fault back to the baseline.
+    int before = 0;     // The number of samples before the fault.
+    double mean = 0;
+
+    for (int i = 0; i < test_case->num_depth_samples; i++) {
+        int depth = test_case->depth_samples[i];
+
+        if (i < start) {
+            mean += depth;
+            before++;
+
+            if (depth > baseline)
+                baseline = depth;
+        } else if (depth > peak) {
+            peak = depth;
+            peak_sample = i;
+        }
+
+        if (i >= end && recovered < 0 && depth <= baseline)
+            recovered = i;
+    }
+
+    printf("\tFault: %s at %lld ms for %lld ms (factor %d), depth before = %.1f mean / %d max, peak = %d at %d ms, ", faultName(test_case->fault),
+           test_case->fault_at / 1000000, test_case->fault_for / 1000000, test_case->fault_factor, before ? mean / before : 0,
+           baseline, peak, (peak_sample + 1) * FAULT_SAMPLE_MS);
+
+    if (test_case->num_depth_samples <= end)
+        printf("test case ended during the fault\n");
+    else if (recovered < 0)
+        printf("not recovered within %d ms after the fault\n", (test_case->num_depth_samples - end) * FAULT_SAMPLE_MS);
+    else
+        printf("recovered %d ms after the fault\n", (recovered - end + 1) * FAULT_SAMPLE_MS);
+
+    for (int phase = FAULT_BEFORE; phase <= FAULT_AFTER; phase++) {
+        Latency merged;
+
+        memset(&merged, 0, sizeof(merged));
+
+        for (int i = test_case->num_producers; i < test_case->num_workers; i++)
+            mergeLatency(&merged, &test_case->workers[i].fault_latency[phase]);
+
+        if (!merged.samples)
+            continue;
+
+        printf("\t\tpushed %s: items = %lu, mean = %.3f ms, p99 <= %.3f ms, max = %.3f ms\n", phases[phase], merged.samples, merged.total / 1e6 / merged.samples,
+               latencyPercentile(&merged, 0.99) / 1e6, merged.max / 1e6);
+    }
+}
@@ -0,0 +1,252 @@
+/**
+ * Isolated test cases: with '--isolate', every test case runs in a child process forked
+ * for it, so that a row that wedges its threads or corrupts its heap cannot affect the
+ * rows after it, and every row starts from a fresh heap and no leftover threads.
+ *
+ * The child prints its report as usual and then writes its TestCaseResult to a pipe. The
+ * parent waits for the result for at most the timeout, then terminates the child (killing
+ * it if it does not exit within a grace period), and finally prints a summary of every row.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#include "simulator.h"
+
+#define KILL_GRACE_MS 1000 // How long a child has to exit after SIGTERM before it is sent SIGKILL.
+
+/**
+ * Forks the child process running a test case.
+ *
+ * @param channel Receives the end of the result pipe of the calling process: the reading
+ * end in the parent, the writing end in the child.
+ *
+ * @return The child's pid in the parent, 0 in the child, or -1 if no child could be forked.
+ */
+pid_t forkTestCase(int *channel)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    // Anything still buffered would otherwise be printed by both processes.
+    fflush(stdout);
+    fflush(stderr);
+
+    // The child draws its own random numbers rather than repeating the parent's.
+    unsigned int seed = (unsigned int)rand();
+    pid_t child = fork();
+
+    if (child < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    // The child gets a process group of its own, so that a terminal's SIGINT only reaches
+    // the parent, which forwards it.
+    if (child == 0) {
+        close(fds[0]);
+        setpgid(0, 0);
+        srand(seed);
+        startSignalThread();
+        *channel = fds[1];
+    } else {
+        setpgid(child, child);
+        close(fds[1]);
+        *channel = fds[0];
+    }
+
+    return child;
+}
+
+/**
+ * Sends the result of a test case to the parent process and closes the pipe (from the child).
+ *
+ * @param channel The writing end of the result pipe.
+ * @param result The result of the test case.
+ */
+void reportResult(int channel, const TestCaseResult *result)
+{
+    const char *bytes = (const char *)result;
+    size_t written = 0;
+
+    fflush(stdout);
+
+    while (written < sizeof(TestCaseResult)) {
+        ssize_t n = write(channel, bytes + written, sizeof(TestCaseResult) - written);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            perror("write");
+            break;
+        }
+
+        written += n;
+    }
+
+    close(channel);
+}
+
+/**
+ * Waits for a child to exit, for at most a given number of milliseconds.
+ *
+ * @return Whether the child exited (and was reaped).
+ */
+static bool reap(pid_t child, int *status, int timeout_ms)
+{
+    for (int waited = 0; ; waited += 10) {
+        pid_t pid = waitpid(child, status, WNOHANG);
+
+        if (pid == child)
+            return true;
+
+        if (pid < 0 && errno != EINTR) {
+            perror("waitpid");
+            return true;
+        }
+
+        if (waited >= timeout_ms)
+            return false;
+
+        usleep(10000);
+    }
+}
+
+/**
+ * Collects the result of a test case run in a child process (from the parent), terminating
+ * the child if it runs past the timeout.
+ *
+ * @param test_case_number The test case number.
+ * @param child The child process running the test case.
+ * @param channel The reading end of the result pipe, closed on return.
+ * @param timeout The number of seconds the child may run.
+ * @param result Receives the child's result ('verified' is false if it sent none).
+ *
+ * @return Whether the child exited by itself and sent a result.
+ */
+bool awaitTestCase(int test_case_number, pid_t child, int channel, int timeout, TestCaseResult *result)
+{
+    struct timespec start;
+    size_t received = 0;
+    bool timed_out = false;
+
+    memset(result, 0, sizeof(TestCaseResult));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The child closes the pipe by exiting, after sending its result (if it gets that far).
+    while (true) {
+        struct timespec current;
+        clock_gettime(CLOCK_MONOTONIC, &current);
+
+        long long elapsed = (current.tv_sec - start.tv_sec) * 1000LL + (current.tv_nsec - start.tv_nsec) / 1000000;
+        struct pollfd readable = {channel, POLLIN, 0};
+
+        if (elapsed >= timeout * 1000LL) {
+            timed_out = true;
+            break;
+        }
+
+        int ready = poll(&readable, 1, (int)(timeout * 1000LL - elapsed));
+
+        if (ready < 0 && errno == EINTR)
+            continue;
+
+        if (ready < 0) {
+            perror("poll");
+            break;
+        }
+
+        if (ready == 0)
+            continue;
+
+        ssize_t n = read(channel, (char *)result + received, received < sizeof(TestCaseResult) ? sizeof(TestCaseResult) - received : 1);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            break;
+
+        if (received < sizeof(TestCaseResult))
+            received += n;
+    }
+
+    close(channel);
+
+    int status = 0;
+    bool exited = !timed_out && reap(child, &status, KILL_GRACE_MS);
+
+    if (!exited) {
+        kill(child, SIGTERM);
+
+        if (!reap(child, &status, KILL_GRACE_MS)) {
+            kill(child, SIGKILL);
+            waitpid(child, &status, 0);
+        }
+    }
+
+    if (received < sizeof(TestCaseResult))
+        memset(result, 0, sizeof(TestCaseResult));
+
+    // A killed child may have been cut off in the middle of a line.
+    if (timed_out)
+        printf("\n\tIsolation: test case %d ran past its %d s timeout and was killed\n", test_case_number, timeout);
+    else if (WIFSIGNALED(status))
+        printf("\tIsolation: test case %d was killed by signal %d (%s)\n", test_case_number, WTERMSIG(status), strsignal(WTERMSIG(status)));
+    else if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        printf("\tIsolation: test case %d exited with status %d\n", test_case_number, WEXITSTATUS(status));
+
+    fflush(stdout);
+
+    return !timed_out && exited && WIFEXITED(status) && WEXITSTATUS(status) == 0 && received == sizeof(TestCaseResult);
+}
+
+/**
+ * Prints one line per test case run in a child process with the result it sent.
+ *
+ * @param results The result of each test case.
+ * @param ran Whether each test case was run (rather than rejected by its configuration).
+ * @param number_of_test_cases The number of test cases.
+ */
+void printSummary(const TestCaseResult *results, const bool *ran, int number_of_test_cases)
+{
+    printf("Summary\n");
+
+    for (int i = 0; i < number_of_test_cases; i++) {
+        const TestCaseResult *result = &results[i];
+
+        if (!ran[i])
+            continue;
+
+        if (!result->verified) {
+            printf("\tTest Case %d: no result\n", i + 1);
+            continue;
+        }
+
+        printf("\tTest Case %d: %s, produced = %lu, consumed = %lu, lost = %lu, duplicated = %lu, out of order = %lu, corrupt = %lu, throughput = %.1f items/s, seed = %llu",
+               i + 1, result->passed ? "PASS" : "FAIL", result->produced, result->consumed, result->lost, result->duplicates, result->out_of_order, result->corrupt, result->throughput,
+               result->seed);
+
+        if (result->p99)
+            printf(", p99 <= %.3f ms", result->p99 / 1e6);
+
+        printf("\n");
+    }
+}
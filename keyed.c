@@ -0,0 +1,230 @@
+/**
+ * Keyed test cases: every item carries a key drawn from a Zipf distribution, and each
+ * consumer owns a partition (a queue of its own) receiving the keys that hash to it. As
+ * a key is only ever consumed by one consumer, from one queue, the items of a key are
+ * processed in the order they were pushed.
+ *
+ * Consumers check that every key reaches a single consumer and that each producer's items
+ * of a key arrive in order; the report shows how unevenly the keys load the consumers.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "simulator.h"
+
+/**
+ * Scatters the keys over the partitions (MurmurHash3's finalizer), so that consecutive
+ * (and equally popular) keys do not land on the same consumer.
+ */
+static uint32_t hashKey(unsigned int key)
+{
+    uint32_t h = key;
+
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/**
+ * Allocates the partitions of a keyed test case and the tables used to validate it.
+ *
+ * @param test_case The test case, whose 'num_keys' is positive.
+ * @param num_producers The number of producers.
+ * @param num_consumers The number of consumers, and so of partitions.
+ * @param item_size The size of the items (and their payload) in bytes.
+ *
+ * @return Whether the partitions could be allocated.
+ */
+bool initPartitions(TestCase *test_case, int num_producers, int num_consumers, size_t item_size)
+{
+    int num_keys = test_case->num_keys;
+    double total = 0;
+
+    test_case->key_cdf = (double *)malloc(sizeof(double) * num_keys);
+    test_case->key_owner = (int *)malloc(sizeof(int) * num_keys);
+    test_case->key_last = (long long *)malloc(sizeof(long long) * num_keys * num_producers);
+    test_case->partitions = (Queue *)calloc(num_consumers, sizeof(Queue));
+
+    if (!test_case->key_cdf || !test_case->key_owner || !test_case->key_last || !test_case->partitions) {
+        perror("malloc");
+        destroyPartitions(test_case);
+        return false;
+    }
+
+    // The key of rank k is drawn with a probability proportional to 1 / k^zipf.
+    for (int key = 0; key < num_keys; key++) {
+        total += 1.0 / pow(key + 1, test_case->zipf);
+        test_case->key_cdf[key] = total;
+        test_case->key_owner[key] = -1;
+    }
+
+    for (int key = 0; key < num_keys; key++)
+        test_case->key_cdf[key] /= total;
+
+    for (int i = 0; i < num_keys * num_producers; i++)
+        test_case->key_last[i] = -1;
+
+    for (int i = 0; i < num_consumers; i++) {
+        if (!queueInit(&test_case->partitions[i], test_case->engine, test_case->BSIZE, item_size, &test_case->layout)) {
+            destroyPartitions(test_case);
+            return false;
+        }
+
+        test_case->partitions[i].observer = observe;
+        test_case->num_partitions++;
+    }
+
+    return true;
+}
+
+/**
+ * Releases the partitions of a keyed test case.
+ *
+ * @param test_case The test case.
+ */
+void destroyPartitions(TestCase *test_case)
+{
+    for (int i = 0; i < test_case->num_partitions; i++)
+        queueDestroy(&test_case->partitions[i]);
+
+    free(test_case->partitions);
+    free(test_case->key_cdf);
+    free(test_case->key_owner);
+    free(test_case->key_last);
+
+    test_case->partitions = NULL;
+    test_case->num_partitions = 0;
+    test_case->key_cdf = NULL;
+    test_case->key_owner = NULL;
+    test_case->key_last = NULL;
+}
+
+/**
+ * The number of queues of a test case: its partitions, or its single buffer.
+ */
+int numTestCaseQueues(const TestCase *test_case)
+{
+    return test_case->num_partitions ? test_case->num_partitions : 1;
+}
+
+/**
+ * A queue of a test case: the partition of the given index, or its single buffer.
+ */
+Queue *testCaseQueue(TestCase *test_case, int index)
+{
+    return test_case->num_partitions ? &test_case->partitions[index] : &test_case->queue;
+}
+
+/**
+ * Draws the key of the next item of a keyed test case.
+ *
+ * @param test_case The test case.
+ * @param seed The state of the calling producer's random number stream.
+ *
+ * @return A key, below 'num_keys'.
+ */
+unsigned int drawKey(const TestCase *test_case, unsigned int *seed)
+{
+    double u = rand_r(seed) / (RAND_MAX + 1.0);
+    int low = 0;
+    int high = test_case->num_keys - 1;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+
+        if (test_case->key_cdf[middle] > u)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+
+    return (unsigned int)low;
+}
+
+/**
+ * Finds the partition an item's key is routed to.
+ *
+ * @param test_case The keyed test case.
+ * @param key The key.
+ *
+ * @return The partition's queue.
+ */
+Queue *partitionOf(TestCase *test_case, unsigned int key)
+{
+    return &test_case->partitions[hashKey(key) % (uint32_t)test_case->num_partitions];
+}
+
+/**
+ * Checks that an item consumed from a keyed test case reached the only consumer of its key,
+ * after every earlier item of its key from the same producer.
+ *
+ * @param consumer The consumer that consumed the item.
+ * @param item The consumed item, whose producer id is valid.
+ */
+void recordKey(Worker *consumer, Item item)
+{
+    TestCase *test_case = consumer->test_case;
+    int owner = -1;
+
+    if (item.key >= (unsigned int)test_case->num_keys) {
+        consumer->corrupt++;
+        return;
+    }
+
+    if (!__atomic_compare_exchange_n(&test_case->key_owner[item.key], &owner, consumer->id, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) && owner != consumer->id)
+        consumer->misrouted++;
+
+    long long *last = &test_case->key_last[(size_t)item.key * test_case->num_producers + item.producer_id];
+    long long previous = __atomic_load_n(last, __ATOMIC_RELAXED);
+
+    if ((long long)item.sequence < previous)
+        consumer->key_out_of_order++;
+    else
+        __atomic_store_n(last, (long long)item.sequence, __ATOMIC_RELAXED);
+}
+
+/**
+ * Prints the throughput of a keyed test case, how evenly its consumers were loaded and
+ * whether every key kept its order.
+ *
+ * @param test_case The finished test case.
+ */
+void reportPartitions(TestCase *test_case)
+{
+    int num_consumers = test_case->num_workers - test_case->num_producers;
+    unsigned long consumed = 0;
+    unsigned long busiest = 0;
+    unsigned long misrouted = 0;
+    unsigned long out_of_order = 0;
+    double elapsed = (now() - test_case->started) / 1e9;
+
+    printf("\tPartitions: keys = %d, zipf = %.2f, items per consumer =", test_case->num_keys, test_case->zipf);
+
+    for (int i = test_case->num_producers; i < test_case->num_workers; i++) {
+        Worker *consumer = &test_case->workers[i];
+
+        printf(" %lu", consumer->operations);
+
+        consumed += consumer->operations;
+        misrouted += consumer->misrouted;
+        out_of_order += consumer->key_out_of_order;
+
+        if (consumer->operations > busiest)
+            busiest = consumer->operations;
+    }
+
+    // The imbalance is the busiest consumer's share over an even share: 1 is perfectly even.
+    double imbalance = consumed ? (double)busiest * num_consumers / consumed : 0;
+
+    printf(", imbalance = %.2f, hottest key = %.1f%%, throughput = %.0f items/s\n", imbalance, 100 * test_case->key_cdf[0], consumed / elapsed);
+    printf("\tKey order: misrouted = %lu, out of order = %lu (%s)\n", misrouted, out_of_order, !misrouted && !out_of_order ? "PASS" : "FAIL");
+}
@@ -0,0 +1,135 @@
+/**
+ * Latency histograms: each consumer records how long the items it processes spent between
+ * their push and their pop in a histogram of its own, and the histograms are merged once
+ * the test case is over.
+ *
+ * The buckets split every power of two of nanoseconds into four, so a percentile is
+ * reported as the upper bound of its bucket, at most 25% above the true value.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "simulator.h"
+
+/**
+ * The bucket of a latency: the latency itself below 4 ns, then four buckets per power of two.
+ */
+static int bucketOf(long long nanoseconds)
+{
+    unsigned long long value = nanoseconds > 0 ? (unsigned long long)nanoseconds : 0;
+
+    if (value < 4)
+        return (int)value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (exponent - 2)) & 3;
+
+    return 4 * (exponent - 1) + sub;
+}
+
+/**
+ * The largest latency falling into a bucket.
+ */
+static long long bucketLimit(int bucket)
+{
+    if (bucket < 4)
+        return bucket;
+
+    int exponent = bucket / 4 + 1;
+    long long lower = (long long)(4 + bucket % 4) << (exponent - 2);
+
+    return lower + ((long long)1 << (exponent - 2)) - 1;
+}
+
+/**
+ * Adds a latency to a histogram.
+ *
+ * @param latency The histogram.
+ * @param nanoseconds The latency (negative latencies count as 0).
+ */
+void recordLatency(Latency *latency, long long nanoseconds)
+{
+    if (nanoseconds < 0)
+        nanoseconds = 0;
+
+    latency->counts[bucketOf(nanoseconds)]++;
+    latency->samples++;
+    latency->total += nanoseconds;
+
+    if (nanoseconds > latency->max)
+        latency->max = nanoseconds;
+}
+
+/**
+ * Adds every latency of a histogram to another one.
+ *
+ * @param into The histogram receiving the latencies.
+ * @param from The histogram whose latencies are added.
+ */
+void mergeLatency(Latency *into, const Latency *from)
+{
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        into->counts[i] += from->counts[i];
+
+    into->samples += from->samples;
+    into->total += from->total;
+
+    if (from->max > into->max)
+        into->max = from->max;
+}
+
+/**
+ * Estimates a percentile of a histogram.
+ *
+ * @param latency The histogram.
+ * @param fraction The fraction of latencies at or below the percentile, e.g. 0.99.
+ *
+ * @return An upper bound of the percentile in nanoseconds (0 for an empty histogram).
+ */
+long long latencyPercentile(const Latency *latency, double fraction)
+{
+    unsigned long rank = (unsigned long)(fraction * latency->samples + 0.5);
+    unsigned long seen = 0;
+
+    if (!latency->samples)
+        return 0;
+
+    if (rank < 1)
+        rank = 1;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += latency->counts[i];
+
+        if (seen >= rank)
+            return bucketLimit(i) < latency->max ? bucketLimit(i) : latency->max;
+    }
+
+    return latency->max;
+}
+
+/**
+ * Prints the latency of the items processed by a test case's consumers.
+ *
+ * @param test_case The finished test case.
+ */
+void reportLatency(TestCase *test_case)
+{
+    Latency merged;
+
+    memset(&merged, 0, sizeof(merged));
+
+    for (int i = test_case->num_producers; i < test_case->num_workers; i++)
+        mergeLatency(&merged, &test_case->workers[i].latency);
+
+    if (!merged.samples)
+        return;
+
+    test_case->result.p99 = latencyPercentile(&merged, 0.99);
+
+    printf("\tLatency: items = %lu, mean = %.3f ms, p50 <= %.3f ms, p99 <= %.3f ms, max = %.3f ms\n", merged.samples,
+           merged.total / 1e6 / merged.samples, latencyPercentile(&merged, 0.5) / 1e6, latencyPercentile(&merged, 0.99) / 1e6, merged.max / 1e6);
+}
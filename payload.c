@@ -0,0 +1,505 @@
+/**
+ * The payload kernels: a portable implementation, plus SSE4.2 and AVX2 ones on x86-64 and
+ * a NEON/CRC one on AArch64. The vector kernels are compiled with per-function target
+ * attributes, so the program runs on any CPU and only calls the kernels it supports.
+ *
+ * The fill pattern is word 'i' = mix(seed + i), stored in the host's byte order. The
+ * xxHash-style checksum runs eight 32-bit lanes over 32-byte stripes, so that a 256-bit
+ * vector (or two 128-bit ones) computes the lanes at once, and merges them with the tail
+ * the same way in every kernel.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#include "payload.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PAYLOAD_X86 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_neon.h>
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define PAYLOAD_ARM 1
+#endif
+
+#define PRIME1 0x9E3779B1u
+#define PRIME2 0x85EBCA77u
+#define PRIME3 0xC2B2AE3Du
+#define PRIME4 0x27D4EB2Fu
+#define PRIME5 0x165667B1u
+
+#define LANES 8                // The number of lanes of the xxHash-style checksum.
+#define STRIPE (LANES * 4)     // The number of bytes consumed per round of the lanes.
+#define CRC32C_POLY 0x82F63B78u // The reflected Castagnoli polynomial.
+
+static inline uint32_t rotl(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t mix(uint32_t x)
+{
+    x *= PRIME1;
+    return x ^ (x >> 16);
+}
+
+static inline uint32_t load32(const unsigned char *p)
+{
+    uint32_t word;
+
+    memcpy(&word, p, sizeof(word));
+
+    return word;
+}
+
+/**
+ * Fills the bytes after the last whole word.
+ */
+static void fillTail(unsigned char *payload, size_t size, size_t words, uint32_t seed)
+{
+    if (size % 4) {
+        uint32_t word = mix(seed + (uint32_t)words);
+
+        memcpy(payload + words * 4, &word, size % 4);
+    }
+}
+
+/**
+ * The lanes' starting values.
+ */
+static inline uint32_t laneSeed(uint32_t seed, int lane)
+{
+    return seed + PRIME1 + (uint32_t)lane * PRIME2;
+}
+
+/**
+ * Merges the lanes (if at least one stripe was hashed) and hashes the bytes after the last
+ * whole stripe.
+ */
+static uint32_t xxFinish(const uint32_t *lanes, const unsigned char *tail, size_t size, uint32_t seed)
+{
+    size_t remaining = size % STRIPE;
+    uint32_t h = seed + PRIME5;
+
+    if (size >= STRIPE) {
+        h = 0;
+
+        for (int j = 0; j < LANES; j++)
+            h += rotl(lanes[j], 1 + 3 * j);
+    }
+
+    h += (uint32_t)size;
+
+    for (; remaining >= 4; tail += 4, remaining -= 4)
+        h = rotl(h + load32(tail) * PRIME3, 17) * PRIME4;
+
+    for (; remaining > 0; tail++, remaining--)
+        h = rotl(h + *tail * PRIME5, 11) * PRIME1;
+
+    h ^= h >> 15;
+    h *= PRIME2;
+    h ^= h >> 13;
+    h *= PRIME3;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/*
+ * Portable kernels.
+ */
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void initCrc32cTable(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+        crc32c_table[i] = crc;
+    }
+}
+
+static uint32_t crc32cBytes(uint32_t crc, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        crc = crc32c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+static bool supportedPortable(void)
+{
+    return true;
+}
+
+static void fillPortable(void *payload, size_t size, uint32_t seed)
+{
+    unsigned char *bytes = (unsigned char *)payload;
+    size_t words = size / 4;
+
+    for (size_t i = 0; i < words; i++) {
+        uint32_t word = mix(seed + (uint32_t)i);
+
+        memcpy(bytes + i * 4, &word, 4);
+    }
+
+    fillTail(bytes, size, words, seed);
+}
+
+static uint32_t crc32cPortable(const void *data, size_t size, uint32_t seed)
+{
+    pthread_once(&crc32c_once, initCrc32cTable);
+
+    return ~crc32cBytes(~seed, (const unsigned char *)data, size);
+}
+
+static uint32_t xxhashPortable(const void *data, size_t size, uint32_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t lanes[LANES];
+    size_t stripes = size / STRIPE;
+
+    for (int j = 0; j < LANES; j++)
+        lanes[j] = laneSeed(seed, j);
+
+    for (size_t s = 0; s < stripes; s++, p += STRIPE) {
+        for (int j = 0; j < LANES; j++)
+            lanes[j] = rotl(lanes[j] + load32(p + 4 * j) * PRIME2, 13) * PRIME1;
+    }
+
+    return xxFinish(lanes, p, size, seed);
+}
+
+#ifdef PAYLOAD_X86
+
+/*
+ * SSE4.2 kernels: the CRC32 instruction and 128-bit lanes (SSE4.1 multiplies).
+ */
+
+static bool supportedSse42(void)
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2")))
+static void fillSse42(void *payload, size_t size, uint32_t seed)
+{
+    unsigned char *bytes = (unsigned char *)payload;
+    size_t words = size / 4;
+    size_t i = 0;
+    __m128i index = _mm_add_epi32(_mm_set1_epi32((int)seed), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i step = _mm_set1_epi32(4);
+    const __m128i prime = _mm_set1_epi32((int)PRIME1);
+
+    for (; i + 4 <= words; i += 4) {
+        __m128i x = _mm_mullo_epi32(index, prime);
+
+        _mm_storeu_si128((__m128i *)(bytes + i * 4), _mm_xor_si128(x, _mm_srli_epi32(x, 16)));
+        index = _mm_add_epi32(index, step);
+    }
+
+    for (; i < words; i++) {
+        uint32_t word = mix(seed + (uint32_t)i);
+
+        memcpy(bytes + i * 4, &word, 4);
+    }
+
+    fillTail(bytes, size, words, seed);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(const void *data, size_t size, uint32_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t crc = ~seed;
+
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+
+        memcpy(&word, p, 8);
+        crc = _mm_crc32_u64(crc, word);
+    }
+
+    for (; size > 0; p++, size--)
+        crc = _mm_crc32_u8((uint32_t)crc, *p);
+
+    return ~(uint32_t)crc;
+}
+
+__attribute__((target("sse4.2")))
+static inline __m128i roundSse42(__m128i lane, __m128i input)
+{
+    __m128i x = _mm_add_epi32(lane, _mm_mullo_epi32(input, _mm_set1_epi32((int)PRIME2)));
+
+    x = _mm_or_si128(_mm_slli_epi32(x, 13), _mm_srli_epi32(x, 19));
+
+    return _mm_mullo_epi32(x, _mm_set1_epi32((int)PRIME1));
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t xxhashSse42(const void *data, size_t size, uint32_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t lanes[LANES];
+    size_t stripes = size / STRIPE;
+
+    for (int j = 0; j < LANES; j++)
+        lanes[j] = laneSeed(seed, j);
+
+    __m128i low = _mm_loadu_si128((const __m128i *)lanes);
+    __m128i high = _mm_loadu_si128((const __m128i *)(lanes + 4));
+
+    for (size_t s = 0; s < stripes; s++, p += STRIPE) {
+        low = roundSse42(low, _mm_loadu_si128((const __m128i *)p));
+        high = roundSse42(high, _mm_loadu_si128((const __m128i *)(p + 16)));
+    }
+
+    _mm_storeu_si128((__m128i *)lanes, low);
+    _mm_storeu_si128((__m128i *)(lanes + 4), high);
+
+    return xxFinish(lanes, p, size, seed);
+}
+
+/*
+ * AVX2 kernels: 256-bit lanes, and the SSE4.2 CRC32 instruction.
+ */
+
+static bool supportedAvx2(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("avx2")))
+static void fillAvx2(void *payload, size_t size, uint32_t seed)
+{
+    unsigned char *bytes = (unsigned char *)payload;
+    size_t words = size / 4;
+    size_t i = 0;
+    __m256i index = _mm256_add_epi32(_mm256_set1_epi32((int)seed), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i step = _mm256_set1_epi32(8);
+    const __m256i prime = _mm256_set1_epi32((int)PRIME1);
+
+    for (; i + 8 <= words; i += 8) {
+        __m256i x = _mm256_mullo_epi32(index, prime);
+
+        _mm256_storeu_si256((__m256i *)(bytes + i * 4), _mm256_xor_si256(x, _mm256_srli_epi32(x, 16)));
+        index = _mm256_add_epi32(index, step);
+    }
+
+    for (; i < words; i++) {
+        uint32_t word = mix(seed + (uint32_t)i);
+
+        memcpy(bytes + i * 4, &word, 4);
+    }
+
+    fillTail(bytes, size, words, seed);
+}
+
+__attribute__((target("avx2")))
+static uint32_t xxhashAvx2(const void *data, size_t size, uint32_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t lanes[LANES];
+    size_t stripes = size / STRIPE;
+    const __m256i prime1 = _mm256_set1_epi32((int)PRIME1);
+    const __m256i prime2 = _mm256_set1_epi32((int)PRIME2);
+
+    for (int j = 0; j < LANES; j++)
+        lanes[j] = laneSeed(seed, j);
+
+    __m256i acc = _mm256_loadu_si256((const __m256i *)lanes);
+
+    for (size_t s = 0; s < stripes; s++, p += STRIPE) {
+        __m256i x = _mm256_add_epi32(acc, _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)p), prime2));
+
+        x = _mm256_or_si256(_mm256_slli_epi32(x, 13), _mm256_srli_epi32(x, 19));
+        acc = _mm256_mullo_epi32(x, prime1);
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+
+    return xxFinish(lanes, p, size, seed);
+}
+
+#endif // PAYLOAD_X86
+
+#ifdef PAYLOAD_ARM
+
+/*
+ * NEON kernels, with the ARMv8 CRC32 instructions.
+ */
+
+static bool supportedNeon(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+static void fillNeon(void *payload, size_t size, uint32_t seed)
+{
+    unsigned char *bytes = (unsigned char *)payload;
+    size_t words = size / 4;
+    size_t i = 0;
+    static const uint32_t offsets[4] = {0, 1, 2, 3};
+    uint32x4_t index = vaddq_u32(vdupq_n_u32(seed), vld1q_u32(offsets));
+    const uint32x4_t step = vdupq_n_u32(4);
+    const uint32x4_t prime = vdupq_n_u32(PRIME1);
+
+    for (; i + 4 <= words; i += 4) {
+        uint32x4_t x = vmulq_u32(index, prime);
+
+        vst1q_u8(bytes + i * 4, vreinterpretq_u8_u32(veorq_u32(x, vshrq_n_u32(x, 16))));
+        index = vaddq_u32(index, step);
+    }
+
+    for (; i < words; i++) {
+        uint32_t word = mix(seed + (uint32_t)i);
+
+        memcpy(bytes + i * 4, &word, 4);
+    }
+
+    fillTail(bytes, size, words, seed);
+}
+
+__attribute__((target("+crc")))
+static uint32_t crc32cNeon(const void *data, size_t size, uint32_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t crc = ~seed;
+
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+    }
+
+    for (; size > 0; p++, size--)
+        crc = __crc32cb(crc, *p);
+
+    return ~crc;
+}
+
+static inline uint32x4_t roundNeon(uint32x4_t lane, uint32x4_t input)
+{
+    uint32x4_t x = vaddq_u32(lane, vmulq_u32(input, vdupq_n_u32(PRIME2)));
+
+    x = vsriq_n_u32(vshlq_n_u32(x, 13), x, 19);
+
+    return vmulq_u32(x, vdupq_n_u32(PRIME1));
+}
+
+static uint32_t xxhashNeon(const void *data, size_t size, uint32_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t lanes[LANES];
+    size_t stripes = size / STRIPE;
+
+    for (int j = 0; j < LANES; j++)
+        lanes[j] = laneSeed(seed, j);
+
+    uint32x4_t low = vld1q_u32(lanes);
+    uint32x4_t high = vld1q_u32(lanes + 4);
+
+    for (size_t s = 0; s < stripes; s++, p += STRIPE) {
+        low = roundNeon(low, vreinterpretq_u32_u8(vld1q_u8(p)));
+        high = roundNeon(high, vreinterpretq_u32_u8(vld1q_u8(p + 16)));
+    }
+
+    vst1q_u32(lanes, low);
+    vst1q_u32(lanes + 4, high);
+
+    return xxFinish(lanes, p, size, seed);
+}
+
+#endif // PAYLOAD_ARM
+
+/**
+ * The kernels, from the fastest to the most portable.
+ */
+static const PayloadKernel kernels[] = {
+#ifdef PAYLOAD_X86
+    {"avx2",     supportedAvx2,     fillAvx2,     crc32cSse42,    xxhashAvx2},
+    {"sse4.2",   supportedSse42,    fillSse42,    crc32cSse42,    xxhashSse42},
+#endif
+#ifdef PAYLOAD_ARM
+    {"neon",     supportedNeon,     fillNeon,     crc32cNeon,     xxhashNeon},
+#endif
+    {"portable", supportedPortable, fillPortable, crc32cPortable, xxhashPortable},
+};
+
+#define NUM_KERNELS ((int)(sizeof(kernels) / sizeof(kernels[0])))
+
+/**
+ * Enumerates the kernels compiled in, whether or not the CPU supports them.
+ *
+ * @param index The index of the kernel.
+ *
+ * @return The kernel at the given index, or NULL past the last kernel.
+ */
+const PayloadKernel *payloadKernelAt(int index)
+{
+    if (index < 0 || index >= NUM_KERNELS)
+        return NULL;
+
+    return &kernels[index];
+}
+
+/**
+ * Looks up a kernel the CPU supports.
+ *
+ * @param name The name of the kernel, or "auto" for the fastest one.
+ *
+ * @return The kernel, or NULL if it is unknown or not supported.
+ */
+const PayloadKernel *findPayloadKernel(const char *name)
+{
+    for (int i = 0; i < NUM_KERNELS; i++) {
+        if ((strcmp(name, "auto") == 0 || strcmp(name, kernels[i].name) == 0) && kernels[i].supported())
+            return &kernels[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Looks up a checksum by name ("crc32c" or "xxhash").
+ *
+ * @return Whether the name is known.
+ */
+bool findPayloadChecksum(const char *name, PayloadChecksum *checksum)
+{
+    if (strcmp(name, "crc32c") == 0)
+        *checksum = PAYLOAD_CRC32C;
+    else if (strcmp(name, "xxhash") == 0)
+        *checksum = PAYLOAD_XXHASH;
+    else
+        return false;
+
+    return true;
+}
+
+const char *payloadChecksumName(PayloadChecksum checksum)
+{
+    return checksum == PAYLOAD_CRC32C ? "crc32c" : "xxhash";
+}
+
+/**
+ * Checksums a payload with a kernel.
+ *
+ * @param seed Distinguishes payloads with the same bytes (e.g. the item's sequence number).
+ */
+uint32_t payloadChecksum(const PayloadKernel *kernel, PayloadChecksum checksum, const void *data, size_t size, uint32_t seed)
+{
+    return checksum == PAYLOAD_CRC32C ? kernel->crc32c(data, size, seed) : kernel->xxhash(data, size, seed);
+}
@@ -0,0 +1,58 @@
+/**
+ * The kernels filling and checksumming the payloads carried by the simulator's items, so
+ * that producers and consumers do work proportional to the size of what they move.
+ *
+ * Every kernel computes exactly the same bytes and checksums; they only differ in the
+ * instructions they use. The best kernel the CPU supports is chosen at run time.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct PayloadKernel PayloadKernel;
+
+/**
+ * The checksums a consumer can verify a payload with.
+ */
+typedef enum PayloadChecksum
+{
+    PAYLOAD_CRC32C, // CRC-32C (Castagnoli), as computed by the SSE4.2 and ARMv8 CRC instructions.
+    PAYLOAD_XXHASH  // A 32-bit xxHash-style hash over eight interleaved lanes.
+} PayloadChecksum;
+
+/**
+ * A set of payload kernels using one instruction set.
+ */
+struct PayloadKernel
+{
+    const char *name;
+    bool (*supported)(void);
+
+    void (*fill)(void *payload, size_t size, uint32_t seed);
+    uint32_t (*crc32c)(const void *data, size_t size, uint32_t seed);
+    uint32_t (*xxhash)(const void *data, size_t size, uint32_t seed);
+};
+
+const PayloadKernel *payloadKernelAt(int index);
+const PayloadKernel *findPayloadKernel(const char *name);
+bool findPayloadChecksum(const char *name, PayloadChecksum *checksum);
+const char *payloadChecksumName(PayloadChecksum checksum);
+
+uint32_t payloadChecksum(const PayloadKernel *kernel, PayloadChecksum checksum, const void *data, size_t size, uint32_t seed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PAYLOAD_H
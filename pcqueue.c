@@ -0,0 +1,355 @@
+/**
+ * libpcqueue: the stable C API over the queue engines (see pcqueue.h).
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "pcqueue.h"
+#include "queue.h"
+
+#define DEFAULT_ENGINE "mutex" // The "legacy" engine loses items; it is only for study.
+
+struct pcq_queue
+{
+    Queue queue;
+};
+
+/**
+ * Enumerates the queue engines.
+ *
+ * @param index The index of the engine.
+ *
+ * @return The name of the engine at the given index, or NULL past the last engine.
+ */
+const char *pcq_engine_name(size_t index)
+{
+    const Engine *engine = index <= INT_MAX ? engineAt((int)index) : NULL;
+
+    return engine ? engine->name : NULL;
+}
+
+/**
+ * Describes the restrictions of a queue engine.
+ *
+ * @param index The index of the engine.
+ *
+ * @return A combination of the PCQ_ENGINE_* flags (0 past the last engine).
+ */
+int pcq_engine_flags(size_t index)
+{
+    const Engine *engine = index <= INT_MAX ? engineAt((int)index) : NULL;
+
+    if (!engine)
+        return 0;
+
+    return (engine->single_producer ? PCQ_ENGINE_SINGLE_PRODUCER : 0) | (engine->single_consumer ? PCQ_ENGINE_SINGLE_CONSUMER : 0) |
+           (engine->coalescing ? PCQ_ENGINE_COALESCING : 0) | (engine->byte_budget ? PCQ_ENGINE_BYTE_BUDGET : 0) |
+           (engine->dropping ? PCQ_ENGINE_DROPPING : 0);
+}
+
+/**
+ * Describes a status.
+ *
+ * @param status The status.
+ *
+ * @return A static, human readable description of the status.
+ */
+const char *pcq_status_string(pcq_status status)
+{
+    switch (status) {
+        case PCQ_OK: return "ok";
+        case PCQ_CLOSED: return "closed";
+        case PCQ_WOULD_BLOCK: return "would block";
+        case PCQ_TIMEDOUT: return "timed out";
+        case PCQ_INVALID: return "invalid argument";
+        case PCQ_NO_MEMORY: return "out of memory";
+    }
+
+    return "unknown status";
+}
+
+/**
+ * Creates an empty queue.
+ *
+ * @param queue Receives the queue.
+ * @param engine The name of the engine moving items through the queue, or NULL for the
+ * default one. Only one thread at a time may push to (or pop from) a queue whose engine
+ * is flagged PCQ_ENGINE_SINGLE_PRODUCER (or PCQ_ENGINE_SINGLE_CONSUMER).
+ * @param capacity The maximum number of items in the queue.
+ * @param item_size The size of an item in bytes.
+ *
+ * @return PCQ_OK, PCQ_INVALID or PCQ_NO_MEMORY.
+ */
+pcq_status pcq_create(pcq_queue **queue, const char *engine, size_t capacity, size_t item_size)
+{
+    return pcq_create_with_layout(queue, engine, capacity, item_size, NULL);
+}
+
+/**
+ * Creates an empty queue whose slots are aligned and prefetched as requested.
+ *
+ * @param layout The slot alignment and prefetch distance, or NULL for packed slots and no
+ * prefetching.
+ *
+ * @return PCQ_OK, PCQ_INVALID or PCQ_NO_MEMORY.
+ *
+ * @see pcq_create
+ */
+pcq_status pcq_create_with_layout(pcq_queue **queue, const char *engine, size_t capacity, size_t item_size, const pcq_layout *layout)
+{
+    const Engine *selected = findEngine(engine ? engine : DEFAULT_ENGINE);
+    QueueLayout slots = {0, 0, 0, 0, 0, 0};
+
+    if (!queue || !selected || capacity == 0 || capacity > INT_MAX || item_size == 0 || item_size > SIZE_MAX / capacity)
+        return PCQ_INVALID;
+
+    if (layout) {
+        if ((layout->slot_align & (layout->slot_align - 1)) != 0 || layout->slot_align > 4096 || layout->prefetch > INT_MAX)
+            return PCQ_INVALID;
+
+        slots.slot_align = layout->slot_align;
+        slots.prefetch = (int)layout->prefetch;
+    }
+
+    *queue = (pcq_queue *)malloc(sizeof(pcq_queue));
+
+    if (!*queue)
+        return PCQ_NO_MEMORY;
+
+    if (!queueInit(&(*queue)->queue, selected, (int)capacity, item_size, &slots)) {
+        free(*queue);
+        *queue = NULL;
+        return PCQ_NO_MEMORY;
+    }
+
+    return PCQ_OK;
+}
+
+/**
+ * Releases a queue no thread uses anymore.
+ *
+ * @param queue The queue to destroy (may be NULL).
+ */
+void pcq_destroy(pcq_queue *queue)
+{
+    if (!queue)
+        return;
+
+    queueDestroy(&queue->queue);
+    free(queue);
+}
+
+/**
+ * Closes a queue: every thread blocked pushing or popping is woken up and gets PCQ_CLOSED,
+ * as do all later pushes and pops.
+ *
+ * @param queue The queue to close.
+ */
+void pcq_close(pcq_queue *queue)
+{
+    queueClose(&queue->queue);
+}
+
+/**
+ * Converts a relative timeout into an absolute CLOCK_MONOTONIC deadline.
+ */
+static struct timespec deadlineAfter(uint64_t timeout_ns)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    deadline.tv_sec += timeout_ns / 1000000000;
+    deadline.tv_nsec += timeout_ns % 1000000000;
+
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    return deadline;
+}
+
+/**
+ * Determines why no item was moved.
+ */
+static pcq_status failure(pcq_queue *queue, const struct timespec *deadline)
+{
+    if (__atomic_load_n(&queue->queue.closed, __ATOMIC_SEQ_CST))
+        return PCQ_CLOSED;
+
+    return deadline->tv_sec == 0 && deadline->tv_nsec == 0 ? PCQ_WOULD_BLOCK : PCQ_TIMEDOUT;
+}
+
+/**
+ * Moves items in or out of a queue.
+ *
+ * @param deadline The CLOCK_MONOTONIC time after which to give up; the epoch to give up
+ * without waiting, or NULL to wait as long as necessary.
+ */
+static pcq_status transfer(pcq_queue *queue, bool push, void *items, size_t count, size_t *moved, const struct timespec *deadline)
+{
+    int batch = count > INT_MAX ? INT_MAX : (int)count;
+    int n = 0;
+
+    if (moved)
+        *moved = 0;
+
+    if (!queue || !items || count == 0)
+        return PCQ_INVALID;
+
+    if (push)
+        n = queuePushBatch(&queue->queue, items, batch, deadline);
+    else
+        n = queuePopBatch(&queue->queue, items, batch, deadline);
+
+    if (moved)
+        *moved = n;
+
+    if (n > 0)
+        return PCQ_OK;
+
+    return deadline ? failure(queue, deadline) : PCQ_CLOSED;
+}
+
+/**
+ * Appends an item to the end of a queue, blocking while it is full.
+ *
+ * @return PCQ_OK or PCQ_CLOSED.
+ */
+pcq_status pcq_push(pcq_queue *queue, const void *item)
+{
+    return transfer(queue, true, (void *)item, 1, NULL, NULL);
+}
+
+/**
+ * Removes the first item of a queue, blocking while it is empty.
+ *
+ * @return PCQ_OK or PCQ_CLOSED.
+ */
+pcq_status pcq_pop(pcq_queue *queue, void *item)
+{
+    return transfer(queue, false, item, 1, NULL, NULL);
+}
+
+/**
+ * Appends an item to the end of a queue unless it is full.
+ *
+ * @return PCQ_OK, PCQ_WOULD_BLOCK or PCQ_CLOSED.
+ */
+pcq_status pcq_try_push(pcq_queue *queue, const void *item)
+{
+    struct timespec now = {0, 0};
+
+    return transfer(queue, true, (void *)item, 1, NULL, &now);
+}
+
+/**
+ * Removes the first item of a queue unless it is empty.
+ *
+ * @return PCQ_OK, PCQ_WOULD_BLOCK or PCQ_CLOSED.
+ */
+pcq_status pcq_try_pop(pcq_queue *queue, void *item)
+{
+    struct timespec now = {0, 0};
+
+    return transfer(queue, false, item, 1, NULL, &now);
+}
+
+/**
+ * Appends an item to the end of a queue, blocking for at most 'timeout_ns' nanoseconds
+ * while it is full.
+ *
+ * @return PCQ_OK, PCQ_TIMEDOUT or PCQ_CLOSED.
+ */
+pcq_status pcq_timed_push(pcq_queue *queue, const void *item, uint64_t timeout_ns)
+{
+    struct timespec deadline = deadlineAfter(timeout_ns);
+
+    return transfer(queue, true, (void *)item, 1, NULL, &deadline);
+}
+
+/**
+ * Removes the first item of a queue, blocking for at most 'timeout_ns' nanoseconds while
+ * it is empty.
+ *
+ * @return PCQ_OK, PCQ_TIMEDOUT or PCQ_CLOSED.
+ */
+pcq_status pcq_timed_pop(pcq_queue *queue, void *item, uint64_t timeout_ns)
+{
+    struct timespec deadline = deadlineAfter(timeout_ns);
+
+    return transfer(queue, false, item, 1, NULL, &deadline);
+}
+
+/**
+ * Appends up to 'count' items to the end of a queue, blocking until at least one fits.
+ *
+ * @param pushed Receives the number of items pushed (may be NULL).
+ *
+ * @return PCQ_OK or PCQ_CLOSED.
+ */
+pcq_status pcq_push_batch(pcq_queue *queue, const void *items, size_t count, size_t *pushed)
+{
+    return transfer(queue, true, (void *)items, count, pushed, NULL);
+}
+
+/**
+ * Removes up to 'count' items from the front of a queue, blocking until at least one is
+ * available.
+ *
+ * @param popped Receives the number of items popped (may be NULL).
+ *
+ * @return PCQ_OK or PCQ_CLOSED.
+ */
+pcq_status pcq_pop_batch(pcq_queue *queue, void *items, size_t count, size_t *popped)
+{
+    return transfer(queue, false, items, count, popped, NULL);
+}
+
+/**
+ * Takes a consistent snapshot of a queue's counters.
+ *
+ * @param queue The queue.
+ * @param stats Receives the counters.
+ * @param stats_size The size of the caller's 'pcq_stats' (sizeof(pcq_stats) in the header
+ * it was built against): only that many bytes are written, and any bytes past the fields
+ * this library knows about are zeroed.
+ */
+void pcq_get_stats(pcq_queue *queue, pcq_stats *stats, size_t stats_size)
+{
+    QueueStats counters;
+    pcq_stats snapshot;
+    int size;
+
+    queueStats(&queue->queue, &counters, &size);
+    memset(&snapshot, 0, sizeof(snapshot));
+
+    snapshot.pushed = counters.pushed;
+    snapshot.popped = counters.popped;
+    snapshot.full_waits = counters.full_waits;
+    snapshot.empty_waits = counters.empty_waits;
+    snapshot.push_timeouts = counters.push_timeouts;
+    snapshot.pop_timeouts = counters.pop_timeouts;
+    snapshot.size = size;
+    snapshot.capacity = queue->queue.BSIZE;
+    snapshot.item_size = queue->queue.item_size;
+    snapshot.head_loads = counters.head_loads;
+    snapshot.tail_loads = counters.tail_loads;
+    snapshot.coalesced = counters.coalesced;
+    snapshot.dropped = counters.dropped;
+    snapshot.peak_bytes = counters.peak_bytes;
+
+    if (stats_size <= sizeof(pcq_stats)) {
+        memcpy(stats, &snapshot, stats_size);
+    } else {
+        memcpy(stats, &snapshot, sizeof(pcq_stats));
+        memset((unsigned char *)stats + sizeof(pcq_stats), 0, stats_size - sizeof(pcq_stats));
+    }
+}
@@ -0,0 +1,109 @@
+/**
+ * libpcqueue: the bounded producer-consumer queues benchmarked by the simulator, behind a
+ * stable C API for embedding in other programs.
+ *
+ * A queue holds up to 'capacity' items of 'item_size' bytes each, which are copied in and
+ * out. Every function is thread safe, except 'pcq_destroy', which must only be called
+ * once no other thread uses the queue. Blocking functions return PCQ_CLOSED once the
+ * queue is closed.
+ *
+ * Compatibility: functions and enumerators are only ever added, and fields are only ever
+ * appended to 'pcq_stats'. Callers pass 'sizeof(pcq_stats)' to 'pcq_get_stats', which
+ * writes only that many bytes, so a program built against an older header keeps working
+ * with a newer library (which then omits the fields the program does not know about), and
+ * a newer program with an older library (which zeroes the fields it does not know about).
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#ifndef PCQUEUE_H
+#define PCQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PCQ_VERSION_MAJOR 1
+#define PCQ_VERSION_MINOR 4
+
+typedef struct pcq_queue pcq_queue;
+
+typedef enum pcq_status
+{
+    PCQ_OK = 0,
+    PCQ_CLOSED,      // The queue was closed.
+    PCQ_WOULD_BLOCK, // (try variants) The queue is full (or empty).
+    PCQ_TIMEDOUT,    // (timed variants) The queue stayed full (or empty) until the timeout.
+    PCQ_INVALID,     // An argument is invalid (e.g. an unknown engine or a zero capacity).
+    PCQ_NO_MEMORY
+} pcq_status;
+
+/**
+ * A snapshot of a queue's counters, filled in by 'pcq_get_stats'.
+ */
+typedef struct pcq_stats
+{
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t full_waits;  // The number of times a producer found the queue full.
+    uint64_t empty_waits; // The number of times a consumer found the queue empty.
+    uint64_t push_timeouts;
+    uint64_t pop_timeouts;
+    size_t size;          // The number of items in the queue.
+    size_t capacity;
+    size_t item_size;
+    // Since 1.1 (left 0 by older libraries):
+    uint64_t head_loads;  // (Lock-free engines) The number of loads of the consumers' counter by producers.
+    uint64_t tail_loads;  // (Lock-free engines) The number of loads of the producers' counter by consumers.
+    // Since 1.3 (left 0 by older libraries):
+    uint64_t coalesced;   // (Coalescing engines) The number of pushes that replaced a pending item.
+    // Since 1.4 (left 0 by older libraries):
+    uint64_t dropped;     // (Dropping engines) The number of pushes dropped because the queue was full.
+    uint64_t peak_bytes;  // (Byte-budgeted engines) The most bytes ever held by the queue.
+} pcq_stats;
+
+/**
+ * How a queue lays out and touches its slots; worth tuning for items of a cache line or more.
+ */
+typedef struct pcq_layout
+{
+    size_t slot_align;  // A power of two each slot is padded and aligned to, e.g. 64 (0 packs the slots).
+    unsigned prefetch;  // How many slots ahead pushes and pops prefetch (0 disables prefetching).
+} pcq_layout;
+
+#define PCQ_ENGINE_SINGLE_PRODUCER 1 // The engine supports a single producer thread.
+#define PCQ_ENGINE_SINGLE_CONSUMER 2 // The engine supports a single consumer thread.
+#define PCQ_ENGINE_COALESCING 4      // A push replaces the pending item with the same key (the item's first 4 bytes).
+#define PCQ_ENGINE_BYTE_BUDGET 8     // The queue holds 'capacity' items' worth of length-prefixed records.
+#define PCQ_ENGINE_DROPPING 16       // A push to a full queue drops the item (and succeeds) instead of waiting.
+
+const char *pcq_engine_name(size_t index);
+int pcq_engine_flags(size_t index);
+const char *pcq_status_string(pcq_status status);
+
+pcq_status pcq_create(pcq_queue **queue, const char *engine, size_t capacity, size_t item_size);
+pcq_status pcq_create_with_layout(pcq_queue **queue, const char *engine, size_t capacity, size_t item_size, const pcq_layout *layout);
+void pcq_destroy(pcq_queue *queue);
+void pcq_close(pcq_queue *queue);
+
+pcq_status pcq_push(pcq_queue *queue, const void *item);
+pcq_status pcq_pop(pcq_queue *queue, void *item);
+pcq_status pcq_try_push(pcq_queue *queue, const void *item);
+pcq_status pcq_try_pop(pcq_queue *queue, void *item);
+pcq_status pcq_timed_push(pcq_queue *queue, const void *item, uint64_t timeout_ns);
+pcq_status pcq_timed_pop(pcq_queue *queue, void *item, uint64_t timeout_ns);
+
+pcq_status pcq_push_batch(pcq_queue *queue, const void *items, size_t count, size_t *pushed);
+pcq_status pcq_pop_batch(pcq_queue *queue, void *items, size_t count, size_t *popped);
+
+void pcq_get_stats(pcq_queue *queue, pcq_stats *stats, size_t stats_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PCQUEUE_H
@@ -0,0 +1,390 @@
+/**
+ * The simulator's queue pool mode: instead of one buffer, a test case gets K independent
+ * buffers (each using the row's engine and BSIZE), served by a fixed pool made of the row's
+ * producers and consumers, the way a broker hosts many small queues.
+ *
+ * Producers push every item to a random buffer without blocking, skipping full ones.
+ * Every buffer belongs to one consumer's shard; the first push to an idle buffer schedules
+ * it on its shard's ready list (waking the shard's consumer if it sleeps), and consumers
+ * drain the buffers of their ready list in turn. The threads run flat out (the sleep
+ * durations are ignored) for the test case's duration.
+ *
+ * The report shows what a buffer costs in memory, both as computed from its structures
+ * and as measured by the growth of the resident set, the aggregate throughput, and how
+ * often consumers had to sleep and be woken up per item.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+
+#include "simulator.h"
+
+#define POOL_BATCH 16        // The number of items a consumer pops from a buffer at once.
+#define POOL_IDLE_WAIT_MS 10 // How long a consumer sleeps on an empty ready list before checking for termination.
+
+typedef struct Shard Shard;
+typedef struct PoolThread PoolThread;
+
+/**
+ * The buffers served by one consumer, and the list of those that may hold items.
+ */
+struct Shard
+{
+    pthread_mutex_t lock;
+    pthread_cond_t flag;
+    int *ready;          // A ring of the indices of the scheduled buffers (each at most once).
+    int capacity;        // The number of buffers of the shard.
+    int first;
+    int count;
+    bool sleeping;       // Whether the consumer waits on 'flag'.
+    char pad[QUEUE_CACHE_LINE];
+};
+
+/**
+ * The state of one thread of the pool.
+ */
+struct PoolThread
+{
+    Worker *worker;
+    unsigned int seed;
+    bool *scheduled;     // Whether each buffer is on its shard's ready list.
+    Shard *shards;
+
+    unsigned long full;  // (Producers) Pushes skipped because the chosen buffer was full.
+    unsigned long wakes; // (Producers) Consumers woken up.
+    unsigned long sleeps;      // (Consumers) Waits on an empty ready list.
+    unsigned long empty_pops;  // (Consumers) Scheduled buffers found empty.
+};
+
+/**
+ * Puts a buffer on its shard's ready list, unless it already is, and wakes the shard's
+ * consumer if it sleeps.
+ */
+static void schedule(PoolThread *thread, int index)
+{
+    TestCase *test_case = thread->worker->test_case;
+    int num_consumers = test_case->num_workers - test_case->num_producers;
+    Shard *shard = &thread->shards[index % num_consumers];
+
+    if (__atomic_exchange_n(&thread->scheduled[index], true, __ATOMIC_SEQ_CST))
+        return;
+
+    pthread_mutex_lock(&shard->lock);
+
+    shard->ready[(shard->first + shard->count) % shard->capacity] = index / num_consumers;
+    shard->count++;
+
+    if (shard->sleeping) {
+        pthread_cond_signal(&shard->flag);
+        thread->wakes++;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * The function used with a producer thread of the pool.
+ */
+static void *poolProduce(void *argv)
+{
+    PoolThread *thread = (PoolThread *)argv;
+    Worker *worker = thread->worker;
+    TestCase *test_case = worker->test_case;
+    struct timespec epoch = {0, 0};
+
+    while (!__atomic_load_n(&test_case->terminated, __ATOMIC_RELAXED)) {
+        int index = rand_r(&thread->seed) % test_case->num_partitions;
+        Queue *queue = &test_case->partitions[index];
+        Item item = {rand_r(&thread->seed) % 201, worker->id, worker->sequence, 0, 0, now(), 0, sizeof(Item)};
+
+        if (!queuePushBatch(queue, &item, 1, &epoch)) {
+            if (__atomic_load_n(&queue->closed, __ATOMIC_RELAXED))
+                break;
+
+            thread->full++;
+            sched_yield();
+            continue;
+        }
+
+        worker->sequence++;
+        __atomic_add_fetch(&worker->operations, 1, __ATOMIC_RELAXED);
+
+        schedule(thread, index);
+    }
+
+    pthread_exit(NULL);
+}
+
+/**
+ * The function used with a consumer thread of the pool.
+ */
+static void *poolConsume(void *argv)
+{
+    PoolThread *thread = (PoolThread *)argv;
+    Worker *worker = thread->worker;
+    TestCase *test_case = worker->test_case;
+    int num_consumers = test_case->num_workers - test_case->num_producers;
+    Shard *shard = &thread->shards[worker->id];
+    unsigned char *records = (unsigned char *)malloc(test_case->partitions[0].item_size * POOL_BATCH);
+    struct timespec epoch = {0, 0};
+
+    if (!records) {
+        perror("malloc");
+        pthread_exit(NULL);
+    }
+
+    while (!__atomic_load_n(&test_case->terminated, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&shard->lock);
+
+        if (!shard->count) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += POOL_IDLE_WAIT_MS * 1000000L;
+
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            shard->sleeping = true;
+            thread->sleeps++;
+            pthread_cond_timedwait(&shard->flag, &shard->lock, &deadline);
+            shard->sleeping = false;
+
+            if (!shard->count) {
+                pthread_mutex_unlock(&shard->lock);
+                continue;
+            }
+        }
+
+        int index = shard->ready[shard->first] * num_consumers + worker->id;
+
+        shard->first = (shard->first + 1) % shard->capacity;
+        shard->count--;
+
+        pthread_mutex_unlock(&shard->lock);
+
+        // Unscheduled before draining, so that a push the drain misses schedules it again.
+        __atomic_store_n(&thread->scheduled[index], false, __ATOMIC_SEQ_CST);
+
+        Queue *queue = &test_case->partitions[index];
+        int popped;
+        bool drained = false;
+
+        while ((popped = queuePopBatch(queue, records, POOL_BATCH, &epoch)) > 0) {
+            long long current_time = now();
+
+            for (int i = 0; i < popped; i++) {
+                Item item;
+
+                memcpy(&item, records + (size_t)i * queue->item_size, sizeof(Item));
+                recordItem(worker, item);
+                recordLatency(&worker->latency, current_time - item.pushed_at);
+            }
+
+            __atomic_add_fetch(&worker->operations, popped, __ATOMIC_RELAXED);
+            drained = true;
+        }
+
+        thread->empty_pops += !drained;
+    }
+
+    free(records);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Allocates the K buffers of a test case.
+ *
+ * @return Whether every buffer could be initialized.
+ */
+static bool initPool(TestCase *test_case, int num_queues)
+{
+    test_case->partitions = (Queue *)calloc(num_queues, sizeof(Queue));
+
+    if (!test_case->partitions) {
+        perror("calloc");
+        return false;
+    }
+
+    for (int i = 0; i < num_queues; i++) {
+        if (!queueInit(&test_case->partitions[i], test_case->engine, test_case->BSIZE, test_case->queue.item_size, &test_case->layout))
+            return false;
+
+        test_case->num_partitions++;
+    }
+
+    return true;
+}
+
+/**
+ * Runs a test case as K independent buffers served by a fixed pool of threads.
+ *
+ * @param test_case_number The current test case number.
+ * @param duration The duration of the test case.
+ * @param num_producers The number of producer threads of the pool.
+ * @param num_consumers The number of consumer threads of the pool.
+ * @param num_queues The number of buffers.
+ * @param test_case The test case providing the engine, BSIZE and layout of the buffers.
+ */
+void serveQueues(int test_case_number, int duration, int num_producers, int num_consumers, int num_queues, TestCase *test_case)
+{
+    printf("Pool Test Case %d\n", test_case_number);
+    printf("\tbufferSize = %d, num_producers = %d, num_consumers = %d, engine = %s, queues = %d \n", test_case->BSIZE, num_producers, num_consumers, test_case->engine->name, num_queues);
+
+    if (num_producers <= 0 || num_consumers <= 0 || num_queues <= 0) {
+        printf("\tNothing to serve\n");
+        return;
+    }
+
+    // A buffer is only ever popped by the consumer of its shard, but pushed by any producer.
+    if (test_case->engine->single_producer && num_producers > 1) {
+        printf("\tEngine '%s' supports a single producer\n", test_case->engine->name);
+        return;
+    }
+
+    // The single buffer only sets the item size and lets 'verify' read the engine.
+    if (!queueInit(&test_case->queue, test_case->engine, test_case->BSIZE, sizeof(Item), &test_case->layout))
+        return;
+
+    size_t virtual_bytes;
+    size_t resident;
+
+    processMemory(&virtual_bytes, &resident);
+    long long started = now();
+    bool ready = initPool(test_case, num_queues);
+    double setup = (now() - started) / 1e9;
+    size_t grown;
+
+    processMemory(&virtual_bytes, &grown);
+    grown -= resident;
+
+    PoolThread *threads = (PoolThread *)calloc(num_producers + num_consumers, sizeof(PoolThread));
+    Shard *shards = (Shard *)calloc(num_consumers, sizeof(Shard));
+    bool *scheduled = (bool *)calloc(num_queues, sizeof(bool));
+    int *rings = (int *)malloc(sizeof(int) * (num_queues + num_consumers));
+
+    if (!ready || !threads || !shards || !scheduled || !rings || !initWorkers(test_case, num_producers, num_consumers)) {
+        if (ready)
+            perror("malloc");
+
+        free(threads);
+        free(shards);
+        free(scheduled);
+        free(rings);
+        destroyPartitions(test_case);
+        queueDestroy(&test_case->queue);
+        return;
+    }
+
+    test_case->unordered = true;
+
+    for (int i = 0, offset = 0; i < num_consumers; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&shards[i].flag, &attr);
+        pthread_condattr_destroy(&attr);
+
+        // Consumer i owns the buffers i, i + num_consumers, i + 2 * num_consumers, ...
+        shards[i].capacity = (num_queues - i + num_consumers - 1) / num_consumers;
+        shards[i].ready = rings + offset;
+        offset += shards[i].capacity + 1;
+    }
+
+    pthread_condattr_t done_flag_attr;
+    pthread_condattr_init(&done_flag_attr);
+    pthread_condattr_setclock(&done_flag_attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&(test_case->done_lock), NULL);
+    pthread_cond_init(&(test_case->done_flag), &done_flag_attr);
+    pthread_condattr_destroy(&done_flag_attr);
+
+    pthread_t ids[num_producers + num_consumers];
+
+    test_case->started = now();
+
+    for (int i = 0; i < num_producers + num_consumers; i++) {
+        threads[i].worker = &test_case->workers[i];
+        threads[i].seed = deriveSeed(test_case->seed, threads[i].worker, RANDOM_ITEMS);
+        threads[i].scheduled = scheduled;
+        threads[i].shards = shards;
+
+        pthread_create(&ids[i], NULL, i < num_producers ? poolProduce : poolConsume, &threads[i]);
+    }
+
+    watchTestCase(test_case);
+
+    // Wait out the test case, unless SIGINT stops it early.
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += duration;
+
+    pthread_mutex_lock(&(test_case->done_lock));
+    while (!test_case->terminated && pthread_cond_timedwait(&(test_case->done_flag), &(test_case->done_lock), &deadline) != ETIMEDOUT);
+    __atomic_store_n(&test_case->terminated, true, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(test_case->done_lock));
+
+    for (int i = 0; i < num_queues; i++)
+        queueClose(&test_case->partitions[i]);
+
+    for (int i = 0; i < num_producers + num_consumers; i++)
+        pthread_join(ids[i], NULL);
+
+    watchTestCase(NULL);
+
+    double elapsed = (now() - test_case->started) / 1e9;
+    unsigned long consumed = 0;
+    unsigned long full = 0;
+    unsigned long wakes = 0;
+    unsigned long sleeps = 0;
+    unsigned long empty_pops = 0;
+
+    for (int i = 0; i < num_producers + num_consumers; i++) {
+        full += threads[i].full;
+        wakes += threads[i].wakes;
+        sleeps += threads[i].sleeps;
+        empty_pops += threads[i].empty_pops;
+
+        if (i >= num_producers)
+            consumed += test_case->workers[i].operations;
+    }
+
+    size_t footprint = queueFootprint(&test_case->partitions[0]);
+    size_t locks = 2 * sizeof(pthread_mutex_t) + 2 * sizeof(pthread_cond_t);
+    size_t scheduler = sizeof(bool) + sizeof(int) + (sizeof(Shard) + sizeof(int)) * num_consumers / num_queues;
+
+    verify(test_case);
+
+    printf("\tFootprint: %zu bytes per buffer (%zu in locks and condition variables, %zu in the buffer), %zu in the pool's scheduler, resident set grew by %.0f bytes per buffer (%.1f MiB), set up in %.3f us per buffer\n",
+           footprint, locks, footprint - sizeof(Queue), scheduler, (double)grown / num_queues, grown / 1048576.0, setup * 1e6 / num_queues);
+    printf("\tPool: throughput = %.0f items/s, full buffers skipped = %.3f per item, consumer sleeps = %.4f per item, wake-up signals = %.4f per item, empty drains = %.4f per item\n",
+           consumed / elapsed, consumed ? (double)full / consumed : 0, consumed ? (double)sleeps / consumed : 0, consumed ? (double)wakes / consumed : 0, consumed ? (double)empty_pops / consumed : 0);
+
+    reportLatency(test_case);
+
+    for (int i = 0; i < num_consumers; i++) {
+        pthread_mutex_destroy(&shards[i].lock);
+        pthread_cond_destroy(&shards[i].flag);
+    }
+
+    pthread_mutex_destroy(&(test_case->done_lock));
+    pthread_cond_destroy(&(test_case->done_flag));
+
+    freeWorkers(test_case);
+    free(threads);
+    free(shards);
+    free(scheduled);
+    free(rings);
+    destroyPartitions(test_case);
+    queueDestroy(&test_case->queue);
+}
@@ -0,0 +1,1479 @@
+/**
+ * The bounded buffer shared by producers and consumers, and the engines that move items
+ * through it.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "queue.h"
+
+static int pushBatchLegacy(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int popBatchLegacy(Queue *queue, void *items, int count, const struct timespec *deadline);
+static void wakeLegacy(Queue *queue);
+static int pushBatchMutex(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int popBatchMutex(Queue *queue, void *items, int count, const struct timespec *deadline);
+static void wakeMutex(Queue *queue);
+static int pushBatchSpscCached(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int popBatchSpscCached(Queue *queue, void *items, int count, const struct timespec *deadline);
+static int pushBatchSpscUncached(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int popBatchSpscUncached(Queue *queue, void *items, int count, const struct timespec *deadline);
+static bool initMpsc(Queue *queue);
+static void destroyMpsc(Queue *queue);
+static int pushBatchMpscCached(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int pushBatchMpscUncached(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int popBatchMpsc(Queue *queue, void *items, int count, const struct timespec *deadline);
+static void wakeLockFree(Queue *queue);
+static bool initCoalesce(Queue *queue);
+static void destroyCoalesce(Queue *queue);
+static int pushBatchCoalesce(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int popBatchCoalesce(Queue *queue, void *items, int count, const struct timespec *deadline);
+static bool initBytes(Queue *queue);
+static int pushBatchBytes(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int pushBatchBytesDropping(Queue *queue, const void *items, int count, const struct timespec *deadline);
+static int popBatchBytes(Queue *queue, void *items, int count, const struct timespec *deadline);
+static int sweepLegacy(Queue *queue, void *items, int count, int64_t now);
+static int sweepMutex(Queue *queue, void *items, int count, int64_t now);
+static void forgetPending(Queue *queue, uint64_t position);
+
+/**
+ * The available queue engines. The first one is used unless another one is selected.
+ */
+static const Engine engines[] = {
+    {"legacy", true, false, false, false, false, false, NULL, NULL, pushBatchLegacy, popBatchLegacy, wakeLegacy, sweepLegacy},
+    {"mutex", true, false, false, false, false, false, NULL, NULL, pushBatchMutex, popBatchMutex, wakeMutex, sweepMutex},
+    {"spsc", true, true, true, false, false, false, NULL, NULL, pushBatchSpscCached, popBatchSpscCached, wakeLockFree, NULL},
+    {"spsc-uncached", true, true, true, false, false, false, NULL, NULL, pushBatchSpscUncached, popBatchSpscUncached, wakeLockFree, NULL},
+    {"mpsc", true, false, true, false, false, false, initMpsc, destroyMpsc, pushBatchMpscCached, popBatchMpsc, wakeLockFree, NULL},
+    {"mpsc-uncached", true, false, true, false, false, false, initMpsc, destroyMpsc, pushBatchMpscUncached, popBatchMpsc, wakeLockFree, NULL},
+    {"coalesce", false, false, false, true, false, false, initCoalesce, destroyCoalesce, pushBatchCoalesce, popBatchCoalesce, wakeMutex, sweepMutex},
+    {"bytes", true, false, false, false, true, false, initBytes, NULL, pushBatchBytes, popBatchBytes, wakeMutex, NULL},
+    {"bytes-drop", true, false, false, false, true, true, initBytes, NULL, pushBatchBytesDropping, popBatchBytes, wakeMutex, NULL},
+};
+
+/**
+ * Reports what the calling thread is doing to the queue's observer, if any.
+ */
+#define OBSERVE(queue, event, lock) \
+    do { \
+        if ((queue)->observer) \
+            (queue)->observer((queue), (event), (lock)); \
+    } while (0)
+
+/**
+ * Determines the number of items in a queue's buffer (thread safe).
+ *
+ * @param queue The queue.
+ *
+ * @return The number of items appended but not yet removed. An engine that lets producers
+ * overrun the buffer (or consumers drain it past empty) can make this exceed the capacity
+ * (or go negative).
+ */
+int queueSize(const Queue *queue)
+{
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    return (int)(int64_t)(tail - head);
+}
+
+/**
+ * Looks up a queue engine by name.
+ *
+ * @param name The name of the engine.
+ *
+ * @return The engine, or NULL if there is no engine with the given name.
+ */
+const Engine *findEngine(const char *name)
+{
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i].name, name) == 0)
+            return &engines[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Enumerates the queue engines.
+ *
+ * @param index The index of the engine.
+ *
+ * @return The engine at the given index, or NULL past the last engine.
+ */
+const Engine *engineAt(int index)
+{
+    if (index < 0 || index >= (int)(sizeof(engines) / sizeof(engines[0])))
+        return NULL;
+
+    return &engines[index];
+}
+
+/**
+ * Initializes an empty queue.
+ *
+ * @param queue The queue to initialize.
+ * @param engine The engine moving items through the queue.
+ * @param capacity The maximum number of items in the queue.
+ * @param item_size The size of an item in bytes.
+ * @param layout The slot alignment (a power of two) and prefetch distance, or NULL for
+ * packed slots and no prefetching.
+ *
+ * @return Whether the queue could be initialized.
+ */
+bool queueInit(Queue *queue, const Engine *engine, int capacity, size_t item_size, const QueueLayout *layout)
+{
+    pthread_condattr_t attr;
+    uint64_t slots = 1;
+    size_t align = layout && layout->slot_align > 1 ? layout->slot_align : 1;
+    void *buf;
+
+    memset(queue, 0, sizeof(Queue));
+
+    // The counters are mapped onto slots with a mask rather than a division, so the number
+    // of slots is the capacity rounded up to a power of two.
+    while (slots < (uint64_t)capacity)
+        slots *= 2;
+
+    queue->engine = engine;
+    queue->BSIZE = capacity;
+    queue->item_size = item_size;
+    queue->mask = slots - 1;
+    queue->slot_size = (item_size + align - 1) & ~(align - 1);
+    queue->prefetch = layout && layout->prefetch > 0 ? layout->prefetch : 0;
+    queue->key_offset = layout ? layout->key_offset : 0;
+    queue->expiry_offset = layout ? layout->expiry_offset : 0;
+    queue->size_offset = layout ? layout->size_offset : 0;
+    queue->byte_budget = layout && layout->byte_budget ? layout->byte_budget : (size_t)capacity * (QUEUE_RECORD_HEADER + item_size);
+
+    // Prefetching a whole lap ahead would only touch the slots being used.
+    if ((uint64_t)queue->prefetch > queue->mask)
+        queue->prefetch = (int)queue->mask;
+
+    // The buffer starts on a cache line, so that aligned slots really are.
+    errno = posix_memalign(&buf, align > QUEUE_CACHE_LINE ? align : QUEUE_CACHE_LINE, engine->byte_budget ? queue->byte_budget : queue->slot_size * slots);
+
+    if (errno) {
+        perror("posix_memalign");
+        return false;
+    }
+
+    queue->buf = (unsigned char *)buf;
+
+    // Deadlines are CLOCK_MONOTONIC times so that they are not affected by clock changes.
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&(queue->producer_lock), NULL);
+    pthread_mutex_init(&(queue->consumer_lock), NULL);
+    pthread_cond_init(&(queue->producer_flag), &attr);
+    pthread_cond_init(&(queue->consumer_flag), &attr);
+
+    pthread_condattr_destroy(&attr);
+
+    if (engine->init && !engine->init(queue)) {
+        queueDestroy(queue);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Releases the resources of a queue no thread uses anymore.
+ *
+ * @param queue The queue to destroy.
+ */
+void queueDestroy(Queue *queue)
+{
+    if (queue->engine->destroy)
+        queue->engine->destroy(queue);
+
+    pthread_mutex_destroy(&(queue->producer_lock));
+    pthread_mutex_destroy(&(queue->consumer_lock));
+    pthread_cond_destroy(&(queue->producer_flag));
+    pthread_cond_destroy(&(queue->consumer_flag));
+
+    free(queue->buf);
+    queue->buf = NULL;
+}
+
+/**
+ * Computes the memory a queue occupies: its structure (locks and condition variables
+ * included), its buffer and any state of its engine.
+ *
+ * @param queue The initialized queue.
+ *
+ * @return The size of the queue in bytes, excluding the allocator's overhead.
+ */
+size_t queueFootprint(const Queue *queue)
+{
+    size_t size = sizeof(Queue) + (queue->engine->byte_budget ? queue->byte_budget : queue->slot_size * (queue->mask + 1));
+
+    if (queue->index)
+        size += (queue->index_mask + 1) * sizeof(uint64_t);
+
+    if (queue->published)
+        size += (queue->mask + 1) * sizeof(uint64_t);
+
+    return size;
+}
+
+/**
+ * Closes a queue: every thread blocked pushing or popping is woken up and fails, as do all
+ * later pushes and pops. Closing a queue again repeats the wake-up.
+ *
+ * @param queue The queue to close.
+ */
+void queueClose(Queue *queue)
+{
+    __atomic_store_n(&queue->closed, true, __ATOMIC_SEQ_CST);
+    queue->engine->wake(queue);
+}
+
+/**
+ * Locates the slot of a queue's buffer holding the item at a given position.
+ *
+ * @param queue The queue.
+ * @param position The number of items appended before the item.
+ *
+ * @return The address of the item.
+ */
+void *queueSlot(const Queue *queue, uint64_t position)
+{
+    return queue->buf + (size_t)(position & queue->mask) * queue->slot_size;
+}
+
+/**
+ * Prefetches the cache lines of the slot 'prefetch' positions after the given one: for
+ * writing when a producer is about to fill it, for reading when a consumer is about to
+ * empty it.
+ */
+static inline void prefetchSlot(const Queue *queue, uint64_t position, bool write)
+{
+    const unsigned char *slot = (const unsigned char *)queueSlot(queue, position + queue->prefetch);
+
+    for (size_t offset = 0; offset < queue->item_size; offset += QUEUE_CACHE_LINE) {
+        if (write)
+            __builtin_prefetch(slot + offset, 1, 3);
+        else
+            __builtin_prefetch(slot + offset, 0, 3);
+    }
+}
+
+/**
+ * Copies items into consecutive slots, prefetching the slots ahead of them.
+ */
+static inline void writeSlots(const Queue *queue, uint64_t position, const unsigned char *items, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (queue->prefetch)
+            prefetchSlot(queue, position + i, true);
+
+        memcpy(queueSlot(queue, position + i), items + (size_t)i * queue->item_size, queue->item_size);
+    }
+}
+
+/**
+ * Copies items out of consecutive slots, prefetching the slots ahead of them.
+ */
+static inline void readSlots(const Queue *queue, uint64_t position, unsigned char *items, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (queue->prefetch)
+            prefetchSlot(queue, position + i, false);
+
+        memcpy(items + (size_t)i * queue->item_size, queueSlot(queue, position + i), queue->item_size);
+    }
+}
+
+/**
+ * Takes a snapshot of a queue's counters and size, which is consistent unless the engine
+ * is lock-free.
+ *
+ * @param queue The queue.
+ * @param stats Receives the counters.
+ * @param size Receives the number of items in the queue.
+ */
+void queueStats(Queue *queue, QueueStats *stats, int *size)
+{
+    pthread_mutex_lock(&(queue->producer_lock));
+    pthread_mutex_lock(&(queue->consumer_lock));
+
+    stats->pushed = __atomic_load_n(&queue->producer.moved, __ATOMIC_RELAXED);
+    stats->popped = __atomic_load_n(&queue->consumer.moved, __ATOMIC_RELAXED);
+    stats->full_waits = __atomic_load_n(&queue->producer.waits, __ATOMIC_RELAXED);
+    stats->empty_waits = __atomic_load_n(&queue->consumer.waits, __ATOMIC_RELAXED);
+    stats->push_timeouts = __atomic_load_n(&queue->producer.timeouts, __ATOMIC_RELAXED);
+    stats->pop_timeouts = __atomic_load_n(&queue->consumer.timeouts, __ATOMIC_RELAXED);
+    stats->head_loads = __atomic_load_n(&queue->producer.remote_loads, __ATOMIC_RELAXED);
+    stats->tail_loads = __atomic_load_n(&queue->consumer.remote_loads, __ATOMIC_RELAXED);
+    stats->coalesced = __atomic_load_n(&queue->producer.coalesced, __ATOMIC_RELAXED);
+    stats->swept = __atomic_load_n(&queue->consumer.swept, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&queue->producer.dropped, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&queue->producer.peak_bytes, __ATOMIC_RELAXED);
+    *size = queueSize(queue);
+
+    pthread_mutex_unlock(&(queue->consumer_lock));
+    pthread_mutex_unlock(&(queue->producer_lock));
+}
+
+/**
+ * Appends an item to the end of a queue, blocking while it is full.
+ *
+ * @param queue The queue.
+ * @param item The item to push.
+ *
+ * @return Whether the item was pushed (false once the queue is closed).
+ */
+bool queuePush(Queue *queue, const void *item)
+{
+    return queue->engine->pushBatch(queue, item, 1, NULL) == 1;
+}
+
+/**
+ * Removes the first item of a queue, blocking while it is empty.
+ *
+ * @param queue The queue.
+ * @param item Receives the popped item.
+ *
+ * @return Whether an item was popped (false once the queue is closed).
+ */
+bool queuePop(Queue *queue, void *item)
+{
+    return queue->engine->popBatch(queue, item, 1, NULL) == 1;
+}
+
+/**
+ * Appends up to 'count' items to the end of a queue, blocking until at least one fits.
+ *
+ * @param queue The queue.
+ * @param items The items to push.
+ * @param count The number of items to push.
+ * @param deadline The CLOCK_MONOTONIC time after which to give up, or NULL to wait as long
+ * as necessary.
+ *
+ * @return The number of items pushed (0 once the queue is closed or the deadline passed).
+ */
+int queuePushBatch(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    return queue->engine->pushBatch(queue, items, count, deadline);
+}
+
+/**
+ * Removes up to 'count' items from the front of a queue, blocking until at least one is
+ * available.
+ *
+ * @param queue The queue.
+ * @param items Receives the popped items.
+ * @param count The maximum number of items to pop.
+ * @param deadline The CLOCK_MONOTONIC time after which to give up, or NULL to wait as long
+ * as necessary.
+ *
+ * @return The number of items popped (0 once the queue is closed or the deadline passed).
+ */
+int queuePopBatch(Queue *queue, void *items, int count, const struct timespec *deadline)
+{
+    return queue->engine->popBatch(queue, items, count, deadline);
+}
+
+/**
+ * Removes the expired items at the front of a queue, without blocking.
+ *
+ * @param queue The queue, whose engine can sweep.
+ * @param items Receives the removed items.
+ * @param count The maximum number of items to remove.
+ * @param now The current CLOCK_MONOTONIC time in nanoseconds.
+ *
+ * @return The number of items removed (0 if the engine cannot sweep or the first item is
+ * still fresh).
+ */
+int queueSweep(Queue *queue, void *items, int count, int64_t now)
+{
+    return queue->engine->sweep ? queue->engine->sweep(queue, items, count, now) : 0;
+}
+
+static void readRecord(const Queue *queue, uint64_t offset, void *item, uint32_t *length);
+
+/**
+ * Copies the first items of a queue without removing them. No thread may push to or pop
+ * from the queue meanwhile.
+ *
+ * @param queue The queue.
+ * @param items Receives the items.
+ * @param count The number of items to copy; slot engines copy that many slots from 'head'
+ * even past 'tail'.
+ *
+ * @return The number of items copied.
+ */
+int queuePeekBatch(Queue *queue, void *items, int count)
+{
+    unsigned char *item = (unsigned char *)items;
+
+    if (!queue->engine->byte_budget) {
+        readSlots(queue, queue->head, item, count);
+        return count;
+    }
+
+    int copied = 0;
+
+    for (uint64_t offset = queue->head_bytes; copied < count && offset < queue->tail_bytes; copied++) {
+        uint32_t length;
+
+        readRecord(queue, offset, item, &length);
+        offset += QUEUE_RECORD_HEADER + length;
+        item += queue->item_size;
+    }
+
+    return copied;
+}
+
+/**
+ * Waits on one of a queue's condition variables.
+ *
+ * @return Whether the wait ended before the deadline (if any).
+ */
+static bool await(pthread_cond_t *flag, pthread_mutex_t *lock, const struct timespec *deadline)
+{
+    if (!deadline) {
+        pthread_cond_wait(flag, lock);
+        return true;
+    }
+
+    return pthread_cond_timedwait(flag, lock, deadline) != ETIMEDOUT;
+}
+
+/**
+ * Appends an item to the end of the buffer. The caller holds the lock(s) that protect the
+ * buffer and has made sure it is not full.
+ */
+static void append(Queue *queue, const void *item)
+{
+    writeSlots(queue, queue->tail, (const unsigned char *)item, 1);
+    __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Removes the first item of the buffer. The caller holds the lock(s) that protect the
+ * buffer and has made sure it is not empty.
+ */
+static void removeFirst(Queue *queue, void *item)
+{
+    readSlots(queue, queue->head, (unsigned char *)item, 1);
+    __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reads the expiry time of an item (0, never, if the items are too small to hold one).
+ */
+static int64_t itemExpiry(const Queue *queue, const void *item)
+{
+    int64_t expiry = 0;
+
+    if (queue->expiry_offset + sizeof(expiry) <= queue->item_size)
+        memcpy(&expiry, (const unsigned char *)item + queue->expiry_offset, sizeof(expiry));
+
+    return expiry;
+}
+
+/**
+ * Removes up to 'count' expired items from the front of the buffer while holding the lock
+ * that serializes the engine's consumers, and lets the producers know there is room.
+ */
+static int sweepLocked(Queue *queue, pthread_mutex_t *lock, QueueLock held, void *items, int count, int64_t now)
+{
+    unsigned char *item = (unsigned char *)items;
+    int swept = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, held);
+    pthread_mutex_lock(lock);
+    OBSERVE(queue, QUEUE_ACQUIRED, held);
+
+    while (swept < count && !queue->closed && queueSize(queue) > 0) {
+        int64_t expiry = itemExpiry(queue, queueSlot(queue, queue->head));
+
+        if (expiry == 0 || expiry > now)
+            break;
+
+        if (queue->index)
+            forgetPending(queue, queue->head);
+
+        removeFirst(queue, item);
+        item += queue->item_size;
+        swept++;
+    }
+
+    queue->consumer.swept += swept;
+
+    if (swept)
+        pthread_cond_broadcast(&(queue->producer_flag));
+
+    pthread_mutex_unlock(lock);
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return swept;
+}
+
+/**
+ * Appends up to 'count' items to the end of the buffer using the original two lock scheme:
+ * producers serialize on the producer lock and consumers on the consumer lock, while both
+ * update the shared 'head' and 'tail' counters.
+ */
+static int pushBatchLegacy(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    const unsigned char *item = (const unsigned char *)items;
+    bool timed_out = false;
+    int pushed = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, QUEUE_LOCK_PRODUCER);
+    pthread_mutex_lock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+
+    if (queueSize(queue) >= queue->BSIZE)
+    {
+        queue->producer.waits++;
+        OBSERVE(queue, QUEUE_WAITING_FULL, QUEUE_LOCK_NONE);
+        timed_out = !await(&(queue->producer_flag), &(queue->producer_lock), deadline) && queueSize(queue) >= queue->BSIZE;
+        OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+    }
+
+    if (timed_out) {
+        queue->producer.timeouts++;
+    } else if (!queue->closed) {
+        do {
+            append(queue, item);
+            item += queue->item_size;
+            pushed++;
+            pthread_cond_signal(&(queue->consumer_flag));
+        } while (pushed < count && queueSize(queue) < queue->BSIZE);
+
+        queue->producer.moved += pushed;
+    }
+
+    pthread_mutex_unlock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return pushed;
+}
+
+/**
+ * Removes up to 'count' items from the front of the buffer using the original two lock
+ * scheme.
+ */
+static int popBatchLegacy(Queue *queue, void *items, int count, const struct timespec *deadline)
+{
+    unsigned char *item = (unsigned char *)items;
+    bool timed_out = false;
+    int popped = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, QUEUE_LOCK_CONSUMER);
+    pthread_mutex_lock(&(queue->consumer_lock));
+    OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_CONSUMER);
+
+    if (queueSize(queue) <= 0)
+    {
+        queue->consumer.waits++;
+        OBSERVE(queue, QUEUE_WAITING_EMPTY, QUEUE_LOCK_NONE);
+        timed_out = !await(&(queue->consumer_flag), &(queue->consumer_lock), deadline) && queueSize(queue) <= 0;
+        OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_CONSUMER);
+    }
+
+    if (timed_out) {
+        queue->consumer.timeouts++;
+    } else if (!queue->closed) {
+        do {
+            removeFirst(queue, item);
+            item += queue->item_size;
+            popped++;
+            pthread_cond_signal(&(queue->producer_flag));
+        } while (popped < count && queueSize(queue) > 0);
+
+        queue->consumer.moved += popped;
+    }
+
+    pthread_mutex_unlock(&(queue->consumer_lock));
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return popped;
+}
+
+/**
+ * Sweeps the front of the buffer as one more consumer of the legacy engine.
+ */
+static int sweepLegacy(Queue *queue, void *items, int count, int64_t now)
+{
+    return sweepLocked(queue, &(queue->consumer_lock), QUEUE_LOCK_CONSUMER, items, count, now);
+}
+
+/**
+ * Wakes the threads blocked in the legacy engine once the queue is closed.
+ *
+ * Like the original shutdown sequence, this does not take either lock, so a thread that
+ * is about to wait may miss the wake-up.
+ */
+static void wakeLegacy(Queue *queue)
+{
+    pthread_cond_broadcast(&(queue->producer_flag));
+    pthread_cond_broadcast(&(queue->consumer_flag));
+}
+
+/**
+ * Appends up to 'count' items to the end of the buffer while holding the producer lock,
+ * which the "mutex" engine uses as the single lock protecting the whole buffer.
+ */
+static int pushBatchMutex(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    const unsigned char *item = (const unsigned char *)items;
+    bool timed_out = false;
+    int pushed = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, QUEUE_LOCK_PRODUCER);
+    pthread_mutex_lock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+
+    while (!timed_out && !queue->closed && queueSize(queue) >= queue->BSIZE)
+    {
+        queue->producer.waits++;
+        OBSERVE(queue, QUEUE_WAITING_FULL, QUEUE_LOCK_NONE);
+        timed_out = !await(&(queue->producer_flag), &(queue->producer_lock), deadline) && queueSize(queue) >= queue->BSIZE;
+        OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+    }
+
+    if (timed_out) {
+        queue->producer.timeouts++;
+    } else if (!queue->closed) {
+        do {
+            append(queue, item);
+            item += queue->item_size;
+            pushed++;
+        } while (pushed < count && queueSize(queue) < queue->BSIZE);
+
+        queue->producer.moved += pushed;
+
+        if (pushed == 1)
+            pthread_cond_signal(&(queue->consumer_flag));
+        else
+            pthread_cond_broadcast(&(queue->consumer_flag));
+    }
+
+    pthread_mutex_unlock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return pushed;
+}
+
+/**
+ * Removes up to 'count' items from the front of the buffer while holding the single lock
+ * of the "mutex" engine.
+ */
+static int popBatchMutex(Queue *queue, void *items, int count, const struct timespec *deadline)
+{
+    unsigned char *item = (unsigned char *)items;
+    bool timed_out = false;
+    int popped = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, QUEUE_LOCK_PRODUCER);
+    pthread_mutex_lock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+
+    while (!timed_out && !queue->closed && queueSize(queue) <= 0)
+    {
+        queue->consumer.waits++;
+        OBSERVE(queue, QUEUE_WAITING_EMPTY, QUEUE_LOCK_NONE);
+        timed_out = !await(&(queue->consumer_flag), &(queue->producer_lock), deadline) && queueSize(queue) <= 0;
+        OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+    }
+
+    if (timed_out) {
+        queue->consumer.timeouts++;
+    } else if (!queue->closed) {
+        do {
+            removeFirst(queue, item);
+            item += queue->item_size;
+            popped++;
+        } while (popped < count && queueSize(queue) > 0);
+
+        queue->consumer.moved += popped;
+
+        if (popped == 1)
+            pthread_cond_signal(&(queue->producer_flag));
+        else
+            pthread_cond_broadcast(&(queue->producer_flag));
+    }
+
+    pthread_mutex_unlock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return popped;
+}
+
+/**
+ * Sweeps the front of the buffer under the single lock of the "mutex" (or "coalesce")
+ * engine.
+ */
+static int sweepMutex(Queue *queue, void *items, int count, int64_t now)
+{
+    return sweepLocked(queue, &(queue->producer_lock), QUEUE_LOCK_PRODUCER, items, count, now);
+}
+
+/**
+ * Wakes the threads blocked in the "mutex" engine once the queue is closed.
+ *
+ * Broadcasting while holding the lock guarantees that every thread either observes
+ * 'closed' before waiting or is already waiting when the broadcast happens.
+ */
+static void wakeMutex(Queue *queue)
+{
+    pthread_mutex_lock(&(queue->producer_lock));
+    pthread_cond_broadcast(&(queue->producer_flag));
+    pthread_cond_broadcast(&(queue->consumer_flag));
+    pthread_mutex_unlock(&(queue->producer_lock));
+}
+
+#define BACKOFF_SPINS 64  // The number of times a lock-free engine spins before yielding.
+#define BACKOFF_YIELDS 64 // The number of times it then yields before sleeping.
+
+/**
+ * Tells the CPU that the calling thread is spinning.
+ */
+static inline void cpuRelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * Backs off while a lock-free engine waits for the other side of the queue: spins at
+ * first, then yields the CPU, then sleeps for growing intervals of up to a millisecond.
+ *
+ * @param attempt The number of times the caller backed off so far (incremented).
+ * @param deadline The CLOCK_MONOTONIC time after which to give up, or NULL.
+ *
+ * @return Whether the caller may keep waiting (false once the deadline passed).
+ */
+static bool backOff(int *attempt, const struct timespec *deadline)
+{
+    if (deadline) {
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec))
+            return false;
+    }
+
+    if (*attempt < BACKOFF_SPINS) {
+        cpuRelax();
+    } else if (*attempt < BACKOFF_SPINS + BACKOFF_YIELDS) {
+        sched_yield();
+    } else {
+        int shift = *attempt - BACKOFF_SPINS - BACKOFF_YIELDS;
+        struct timespec pause = {0, 1000L << (shift < 10 ? shift : 10)};
+
+        nanosleep(&pause, NULL);
+    }
+
+    (*attempt)++;
+
+    return true;
+}
+
+/**
+ * Appends up to 'count' items to the end of the buffer of a single producer, single
+ * consumer queue without any lock: the producer owns 'tail' and the consumer owns 'head'.
+ *
+ * Reading 'head' means fetching the consumer's cache line, so with 'cached' set the
+ * producer works from its last copy of 'head' and only loads it again when that copy
+ * makes the buffer look full. Without 'cached' it loads 'head' on every call.
+ */
+static inline int pushBatchSpsc(Queue *queue, const void *items, int count, const struct timespec *deadline, bool cached)
+{
+    const unsigned char *item = (const unsigned char *)items;
+    uint64_t tail = queue->tail;
+    uint64_t head = queue->cached_head;
+    int attempt = 0;
+    int room;
+
+    if (!cached) {
+        head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        queue->producer.remote_loads++;
+    }
+
+    for (;;) {
+        if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+            room = 0;
+            break;
+        }
+
+        room = queue->BSIZE - (int)(tail - head);
+
+        if (room > 0)
+            break;
+
+        head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        queue->producer.remote_loads++;
+        room = queue->BSIZE - (int)(tail - head);
+
+        if (room > 0)
+            break;
+
+        if (attempt == 0) {
+            queue->producer.waits++;
+            OBSERVE(queue, QUEUE_WAITING_FULL, QUEUE_LOCK_NONE);
+        }
+
+        if (!backOff(&attempt, deadline)) {
+            queue->producer.timeouts++;
+            room = 0;
+            break;
+        }
+    }
+
+    if (attempt > 0)
+        OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    queue->cached_head = head;
+
+    int pushed = count < room ? count : room;
+
+    writeSlots(queue, tail, item, pushed);
+
+    __atomic_store_n(&queue->tail, tail + pushed, __ATOMIC_RELEASE);
+    queue->producer.moved += pushed;
+
+    return pushed;
+}
+
+/**
+ * Removes up to 'count' items from the front of the buffer of a single producer, single
+ * consumer queue without any lock, loading 'tail' only when the consumer's copy of it
+ * makes the buffer look empty (or on every call without 'cached').
+ */
+static inline int popBatchSpsc(Queue *queue, void *items, int count, const struct timespec *deadline, bool cached)
+{
+    unsigned char *item = (unsigned char *)items;
+    uint64_t head = queue->head;
+    uint64_t tail = queue->cached_tail;
+    int attempt = 0;
+    int available;
+
+    if (!cached) {
+        tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        queue->consumer.remote_loads++;
+    }
+
+    for (;;) {
+        if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) {
+            available = 0;
+            break;
+        }
+
+        available = (int)(tail - head);
+
+        if (available > 0)
+            break;
+
+        tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        queue->consumer.remote_loads++;
+        available = (int)(tail - head);
+
+        if (available > 0)
+            break;
+
+        if (attempt == 0) {
+            queue->consumer.waits++;
+            OBSERVE(queue, QUEUE_WAITING_EMPTY, QUEUE_LOCK_NONE);
+        }
+
+        if (!backOff(&attempt, deadline)) {
+            queue->consumer.timeouts++;
+            available = 0;
+            break;
+        }
+    }
+
+    if (attempt > 0)
+        OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    queue->cached_tail = tail;
+
+    int popped = count < available ? count : available;
+
+    readSlots(queue, head, item, popped);
+
+    __atomic_store_n(&queue->head, head + popped, __ATOMIC_RELEASE);
+    queue->consumer.moved += popped;
+
+    return popped;
+}
+
+static int pushBatchSpscCached(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    return pushBatchSpsc(queue, items, count, deadline, true);
+}
+
+static int popBatchSpscCached(Queue *queue, void *items, int count, const struct timespec *deadline)
+{
+    return popBatchSpsc(queue, items, count, deadline, true);
+}
+
+static int pushBatchSpscUncached(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    return pushBatchSpsc(queue, items, count, deadline, false);
+}
+
+static int popBatchSpscUncached(Queue *queue, void *items, int count, const struct timespec *deadline)
+{
+    return popBatchSpsc(queue, items, count, deadline, false);
+}
+
+/**
+ * Allocates the per-slot publication counters of a multiple producer queue.
+ */
+static bool initMpsc(Queue *queue)
+{
+    queue->published = (uint64_t *)calloc(queue->mask + 1, sizeof(uint64_t));
+
+    if (!queue->published) {
+        perror("calloc");
+        return false;
+    }
+
+    return true;
+}
+
+static void destroyMpsc(Queue *queue)
+{
+    free(queue->published);
+    queue->published = NULL;
+}
+
+/**
+ * Appends up to 'count' items to the end of the buffer of a multiple producer, single
+ * consumer queue without any lock.
+ *
+ * Producers claim positions by advancing 'tail' with a compare-and-swap, then copy their
+ * items and publish each slot by storing its position + 1 in 'published', which is what
+ * the consumer waits for (items are not necessarily written in the order they were
+ * claimed). With 'cached' set, the producers share a copy of 'head' on their own cache
+ * line and only load 'head' when that copy makes the buffer look full.
+ */
+static inline int pushBatchMpsc(Queue *queue, const void *items, int count, const struct timespec *deadline, bool cached)
+{
+    const unsigned char *item = (const unsigned char *)items;
+    uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    uint64_t head;
+    int attempt = 0;
+    int pushed = 0;
+
+    for (;;) {
+        if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE))
+            break;
+
+        if (cached) {
+            head = __atomic_load_n(&queue->cached_head, __ATOMIC_ACQUIRE);
+        } else {
+            head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+            __atomic_add_fetch(&queue->producer.remote_loads, 1, __ATOMIC_RELAXED);
+        }
+
+        // A stale copy of 'head' is never ahead of the real one, so it can only underestimate the room.
+        int64_t room = (int64_t)queue->BSIZE - (int64_t)(tail - head);
+
+        if (room <= 0 && cached) {
+            head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+            __atomic_add_fetch(&queue->producer.remote_loads, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&queue->cached_head, head, __ATOMIC_RELEASE);
+            room = (int64_t)queue->BSIZE - (int64_t)(tail - head);
+        }
+
+        if (room > 0) {
+            pushed = count < room ? count : (int)room;
+
+            if (__atomic_compare_exchange_n(&queue->tail, &tail, tail + pushed, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+
+            pushed = 0;
+            continue;
+        }
+
+        if (attempt == 0) {
+            __atomic_add_fetch(&queue->producer.waits, 1, __ATOMIC_RELAXED);
+            OBSERVE(queue, QUEUE_WAITING_FULL, QUEUE_LOCK_NONE);
+        }
+
+        if (!backOff(&attempt, deadline)) {
+            __atomic_add_fetch(&queue->producer.timeouts, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    }
+
+    if (attempt > 0)
+        OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    for (int i = 0; i < pushed; i++) {
+        writeSlots(queue, tail + i, item + (size_t)i * queue->item_size, 1);
+        __atomic_store_n(&queue->published[(tail + i) & queue->mask], tail + i + 1, __ATOMIC_RELEASE);
+    }
+
+    if (pushed > 0)
+        __atomic_add_fetch(&queue->producer.moved, pushed, __ATOMIC_RELAXED);
+
+    return pushed;
+}
+
+static int pushBatchMpscCached(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    return pushBatchMpsc(queue, items, count, deadline, true);
+}
+
+static int pushBatchMpscUncached(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    return pushBatchMpsc(queue, items, count, deadline, false);
+}
+
+/**
+ * Removes up to 'count' items from the front of the buffer of a multiple producer, single
+ * consumer queue. The consumer never reads 'tail': it takes the slots that have been
+ * published, in order, up to the first one that has not.
+ */
+static int popBatchMpsc(Queue *queue, void *items, int count, const struct timespec *deadline)
+{
+    unsigned char *item = (unsigned char *)items;
+    uint64_t head = queue->head;
+    int attempt = 0;
+    int popped = 0;
+
+    for (;;) {
+        if (__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE))
+            break;
+
+        while (popped < count && __atomic_load_n(&queue->published[(head + popped) & queue->mask], __ATOMIC_ACQUIRE) == head + popped + 1)
+            popped++;
+
+        if (popped > 0)
+            break;
+
+        if (attempt == 0) {
+            queue->consumer.waits++;
+            OBSERVE(queue, QUEUE_WAITING_EMPTY, QUEUE_LOCK_NONE);
+        }
+
+        if (!backOff(&attempt, deadline)) {
+            queue->consumer.timeouts++;
+            break;
+        }
+    }
+
+    if (attempt > 0)
+        OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    readSlots(queue, head, item, popped);
+
+    __atomic_store_n(&queue->head, head + popped, __ATOMIC_RELEASE);
+    queue->consumer.moved += popped;
+
+    return popped;
+}
+
+/**
+ * The lock-free engines poll 'closed' while they wait, so there is nobody to wake.
+ */
+static void wakeLockFree(Queue *queue)
+{
+    (void)queue;
+}
+
+/**
+ * Reads the key of an item (0 if the items are too small to hold one at 'key_offset').
+ */
+static uint32_t itemKey(const Queue *queue, const void *item)
+{
+    uint32_t key = 0;
+
+    if (queue->key_offset + sizeof(key) <= queue->item_size)
+        memcpy(&key, (const unsigned char *)item + queue->key_offset, sizeof(key));
+
+    return key;
+}
+
+/**
+ * The index entry at which the lookup of a key starts.
+ */
+static uint64_t homeOf(const Queue *queue, uint32_t key)
+{
+    key ^= key >> 16;
+    key *= 0x85EBCA6Bu;
+    key ^= key >> 13;
+
+    return key & queue->index_mask;
+}
+
+/**
+ * Allocates the index of a coalescing queue, with at least twice as many entries as slots
+ * so that lookups stay short.
+ */
+static bool initCoalesce(Queue *queue)
+{
+    uint64_t entries = 2 * (queue->mask + 1);
+
+    queue->index = (uint64_t *)calloc(entries, sizeof(uint64_t));
+    queue->index_mask = entries - 1;
+
+    if (!queue->index) {
+        perror("calloc");
+        return false;
+    }
+
+    return true;
+}
+
+static void destroyCoalesce(Queue *queue)
+{
+    free(queue->index);
+    queue->index = NULL;
+}
+
+/**
+ * Finds the index entry of the pending item with a given key.
+ *
+ * @return The entry, or NULL if no item with the key is pending.
+ */
+static uint64_t *findPending(Queue *queue, uint32_t key)
+{
+    for (uint64_t i = homeOf(queue, key); queue->index[i]; i = (i + 1) & queue->index_mask) {
+        if (itemKey(queue, queueSlot(queue, queue->index[i] - 1)) == key)
+            return &queue->index[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Removes the item at the given position from the index, moving back the entries that
+ * follow it so that every entry stays reachable from its home.
+ */
+static void forgetPending(Queue *queue, uint64_t position)
+{
+    uint64_t i = homeOf(queue, itemKey(queue, queueSlot(queue, position)));
+
+    while (queue->index[i] != position + 1)
+        i = (i + 1) & queue->index_mask;
+
+    queue->index[i] = 0;
+
+    for (uint64_t j = (i + 1) & queue->index_mask; queue->index[j]; j = (j + 1) & queue->index_mask) {
+        uint64_t home = homeOf(queue, itemKey(queue, queueSlot(queue, queue->index[j] - 1)));
+
+        // The entry may only move back if its home does not lie in (i, j].
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            queue->index[i] = queue->index[j];
+            queue->index[j] = 0;
+            i = j;
+        }
+    }
+}
+
+/**
+ * Appends up to 'count' items while holding the single lock of the "coalesce" engine. An
+ * item whose key is pending overwrites it, keeping its place in the buffer, so only items
+ * with a new key need room.
+ */
+static int pushBatchCoalesce(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    const unsigned char *item = (const unsigned char *)items;
+    bool timed_out = false;
+    int pushed = 0;
+    int appended = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, QUEUE_LOCK_PRODUCER);
+    pthread_mutex_lock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+
+    while (pushed < count && !timed_out && !queue->closed)
+    {
+        uint64_t *pending = findPending(queue, itemKey(queue, item));
+
+        if (pending) {
+            writeSlots(queue, *pending - 1, item, 1);
+            queue->producer.coalesced++;
+        } else if (queueSize(queue) < queue->BSIZE) {
+            uint64_t i = homeOf(queue, itemKey(queue, item));
+
+            while (queue->index[i])
+                i = (i + 1) & queue->index_mask;
+
+            queue->index[i] = queue->tail + 1;
+            append(queue, item);
+            appended++;
+        } else if (pushed > 0) {
+            break;
+        } else {
+            queue->producer.waits++;
+            OBSERVE(queue, QUEUE_WAITING_FULL, QUEUE_LOCK_NONE);
+            timed_out = !await(&(queue->producer_flag), &(queue->producer_lock), deadline) && queueSize(queue) >= queue->BSIZE;
+            OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+            continue;
+        }
+
+        item += queue->item_size;
+        pushed++;
+    }
+
+    if (timed_out)
+        queue->producer.timeouts++;
+
+    queue->producer.moved += pushed;
+
+    if (appended == 1)
+        pthread_cond_signal(&(queue->consumer_flag));
+    else if (appended > 1)
+        pthread_cond_broadcast(&(queue->consumer_flag));
+
+    pthread_mutex_unlock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return pushed;
+}
+
+/**
+ * Removes up to 'count' items from the front of the buffer of the "coalesce" engine,
+ * dropping them from the index.
+ */
+static int popBatchCoalesce(Queue *queue, void *items, int count, const struct timespec *deadline)
+{
+    unsigned char *item = (unsigned char *)items;
+    bool timed_out = false;
+    int popped = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, QUEUE_LOCK_PRODUCER);
+    pthread_mutex_lock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+
+    while (!timed_out && !queue->closed && queueSize(queue) <= 0)
+    {
+        queue->consumer.waits++;
+        OBSERVE(queue, QUEUE_WAITING_EMPTY, QUEUE_LOCK_NONE);
+        timed_out = !await(&(queue->consumer_flag), &(queue->producer_lock), deadline) && queueSize(queue) <= 0;
+        OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+    }
+
+    if (timed_out) {
+        queue->consumer.timeouts++;
+    } else if (!queue->closed) {
+        do {
+            forgetPending(queue, queue->head);
+            removeFirst(queue, item);
+            item += queue->item_size;
+            popped++;
+        } while (popped < count && queueSize(queue) > 0);
+
+        queue->consumer.moved += popped;
+
+        if (popped == 1)
+            pthread_cond_signal(&(queue->producer_flag));
+        else
+            pthread_cond_broadcast(&(queue->producer_flag));
+    }
+
+    pthread_mutex_unlock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return popped;
+}
+
+/**
+ * Checks that a byte-budgeted queue's ring can hold at least one record of the largest
+ * size.
+ */
+static bool initBytes(Queue *queue)
+{
+    if (queue->byte_budget < QUEUE_RECORD_HEADER + queue->item_size) {
+        fprintf(stderr, "A byte budget of %zu bytes cannot hold an item of %zu bytes.\n", queue->byte_budget, queue->item_size);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Reads the number of bytes of an item to store: its size, if the items carry one, or
+ * 'item_size'.
+ */
+static uint32_t itemLength(const Queue *queue, const void *item)
+{
+    uint32_t length = 0;
+
+    if (queue->size_offset && queue->size_offset + sizeof(length) <= queue->item_size)
+        memcpy(&length, (const unsigned char *)item + queue->size_offset, sizeof(length));
+
+    return length && length <= queue->item_size ? length : (uint32_t)queue->item_size;
+}
+
+/**
+ * Copies bytes into the ring at the given offset, wrapping around its end.
+ */
+static void ringWrite(const Queue *queue, uint64_t offset, const void *data, size_t size)
+{
+    size_t at = (size_t)(offset % queue->byte_budget);
+    size_t first = size < queue->byte_budget - at ? size : queue->byte_budget - at;
+
+    memcpy(queue->buf + at, data, first);
+    memcpy(queue->buf, (const unsigned char *)data + first, size - first);
+}
+
+/**
+ * Copies bytes out of the ring at the given offset, wrapping around its end.
+ */
+static void ringRead(const Queue *queue, uint64_t offset, void *data, size_t size)
+{
+    size_t at = (size_t)(offset % queue->byte_budget);
+    size_t first = size < queue->byte_budget - at ? size : queue->byte_budget - at;
+
+    memcpy(data, queue->buf + at, first);
+    memcpy((unsigned char *)data + first, queue->buf, size - first);
+}
+
+/**
+ * Reads the record at the given offset of the ring into an item.
+ *
+ * @param length Receives the number of bytes of the item the record held.
+ */
+static void readRecord(const Queue *queue, uint64_t offset, void *item, uint32_t *length)
+{
+    uint32_t header;
+
+    ringRead(queue, offset, &header, sizeof(header));
+    ringRead(queue, offset + QUEUE_RECORD_HEADER, item, header);
+
+    *length = header;
+}
+
+/**
+ * Appends up to 'count' items as records to the ring of a byte-budgeted engine, under its
+ * single lock. A record only takes the bytes its item uses, so the number of items that
+ * fit depends on their sizes.
+ */
+static inline int pushBatchBytesWith(Queue *queue, const void *items, int count, const struct timespec *deadline, bool dropping)
+{
+    const unsigned char *item = (const unsigned char *)items;
+    bool timed_out = false;
+    int pushed = 0;
+    int appended = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, QUEUE_LOCK_PRODUCER);
+    pthread_mutex_lock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+
+    while (pushed < count && !timed_out && !queue->closed)
+    {
+        uint32_t length = itemLength(queue, item);
+        uint64_t needed = QUEUE_RECORD_HEADER + length;
+
+        if (queue->tail_bytes - queue->head_bytes + needed <= queue->byte_budget) {
+            ringWrite(queue, queue->tail_bytes, &length, sizeof(length));
+            ringWrite(queue, queue->tail_bytes + QUEUE_RECORD_HEADER, item, length);
+            queue->tail_bytes += needed;
+            __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELAXED);
+            appended++;
+
+            if (queue->tail_bytes - queue->head_bytes > queue->producer.peak_bytes)
+                queue->producer.peak_bytes = queue->tail_bytes - queue->head_bytes;
+        } else if (dropping) {
+            queue->producer.dropped++;
+        } else if (pushed > 0) {
+            break;
+        } else {
+            queue->producer.waits++;
+            OBSERVE(queue, QUEUE_WAITING_FULL, QUEUE_LOCK_NONE);
+            timed_out = !await(&(queue->producer_flag), &(queue->producer_lock), deadline) &&
+                        queue->tail_bytes - queue->head_bytes + needed > queue->byte_budget;
+            OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+            continue;
+        }
+
+        item += queue->item_size;
+        pushed++;
+    }
+
+    if (timed_out)
+        queue->producer.timeouts++;
+
+    queue->producer.moved += pushed;
+
+    if (appended == 1)
+        pthread_cond_signal(&(queue->consumer_flag));
+    else if (appended > 1)
+        pthread_cond_broadcast(&(queue->consumer_flag));
+
+    pthread_mutex_unlock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return pushed;
+}
+
+static int pushBatchBytes(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    return pushBatchBytesWith(queue, items, count, deadline, false);
+}
+
+static int pushBatchBytesDropping(Queue *queue, const void *items, int count, const struct timespec *deadline)
+{
+    return pushBatchBytesWith(queue, items, count, deadline, true);
+}
+
+/**
+ * Removes up to 'count' records from the front of the ring of a byte-budgeted engine.
+ * Since every record frees a different number of bytes, every producer is woken up.
+ */
+static int popBatchBytes(Queue *queue, void *items, int count, const struct timespec *deadline)
+{
+    unsigned char *item = (unsigned char *)items;
+    bool timed_out = false;
+    int popped = 0;
+
+    OBSERVE(queue, QUEUE_ACQUIRING, QUEUE_LOCK_PRODUCER);
+    pthread_mutex_lock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+
+    while (!timed_out && !queue->closed && queueSize(queue) <= 0)
+    {
+        queue->consumer.waits++;
+        OBSERVE(queue, QUEUE_WAITING_EMPTY, QUEUE_LOCK_NONE);
+        timed_out = !await(&(queue->consumer_flag), &(queue->producer_lock), deadline) && queueSize(queue) <= 0;
+        OBSERVE(queue, QUEUE_ACQUIRED, QUEUE_LOCK_PRODUCER);
+    }
+
+    if (timed_out) {
+        queue->consumer.timeouts++;
+    } else if (!queue->closed) {
+        do {
+            uint32_t length;
+
+            readRecord(queue, queue->head_bytes, item, &length);
+            queue->head_bytes += QUEUE_RECORD_HEADER + length;
+            __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELAXED);
+            item += queue->item_size;
+            popped++;
+        } while (popped < count && queueSize(queue) > 0);
+
+        queue->consumer.moved += popped;
+        pthread_cond_broadcast(&(queue->producer_flag));
+    }
+
+    pthread_mutex_unlock(&(queue->producer_lock));
+    OBSERVE(queue, QUEUE_RELEASED, QUEUE_LOCK_NONE);
+
+    return popped;
+}
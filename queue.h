@@ -0,0 +1,222 @@
+/**
+ * The bounded buffer shared by producers and consumers, and the engines that move items
+ * through it.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QUEUE_CACHE_LINE 64 // The size of a cache line, used to keep the two sides of a queue apart.
+#define QUEUE_RECORD_HEADER sizeof(uint32_t) // The length prefixed to each record of a byte-budgeted engine.
+
+typedef struct Queue Queue;
+typedef struct QueueSide QueueSide;
+typedef struct QueueStats QueueStats;
+typedef struct QueueLayout QueueLayout;
+typedef struct Engine Engine;
+
+/**
+ * Identifies which of the queue's locks a thread is holding (or acquiring).
+ */
+typedef enum QueueLock
+{
+    QUEUE_LOCK_NONE,
+    QUEUE_LOCK_PRODUCER,
+    QUEUE_LOCK_CONSUMER
+} QueueLock;
+
+/**
+ * The points at which an engine reports what the calling thread is doing to the queue's
+ * observer.
+ */
+typedef enum QueueEvent
+{
+    QUEUE_ACQUIRING,     // About to block acquiring 'lock'.
+    QUEUE_ACQUIRED,      // Holding 'lock' (also reported after returning from a wait).
+    QUEUE_WAITING_FULL,  // About to wait because the buffer is full.
+    QUEUE_WAITING_EMPTY, // About to wait because the buffer is empty.
+    QUEUE_RELEASED       // No longer holding any lock.
+} QueueEvent;
+
+typedef void (*QueueObserver)(const Queue *queue, QueueEvent event, QueueLock lock);
+
+/**
+ * The counters of one side of a queue (its producers or its consumers). They are only
+ * updated by that side: while holding the lock that serializes it, or by its single
+ * thread (or atomically) in the lock-free engines.
+ */
+struct QueueSide
+{
+    unsigned long long moved;        // The number of items pushed (or popped).
+    unsigned long long waits;        // The number of times the buffer was found full (or empty).
+    unsigned long long timeouts;
+    unsigned long long remote_loads; // (Lock-free engines) The number of loads of the other side's counter.
+    unsigned long long coalesced;    // (Coalescing engines, producers) The number of items that replaced a pending item.
+    unsigned long long swept;        // (Consumers) The number of expired items removed by 'queueSweep'.
+    unsigned long long dropped;      // (Dropping engines, producers) The number of items dropped for lack of room.
+    unsigned long long peak_bytes;   // (Byte-budgeted engines, producers) The most bytes of records ever in the buffer.
+};
+
+/**
+ * A snapshot of a queue's counters.
+ */
+struct QueueStats
+{
+    unsigned long long pushed;
+    unsigned long long popped;
+    unsigned long long full_waits;  // The number of times a producer waited on a full buffer.
+    unsigned long long empty_waits; // The number of times a consumer waited on an empty buffer.
+    unsigned long long push_timeouts;
+    unsigned long long pop_timeouts;
+    unsigned long long head_loads;  // The number of loads of 'head' by producers of a lock-free engine.
+    unsigned long long tail_loads;  // The number of loads of 'tail' by consumers of a lock-free engine.
+    unsigned long long coalesced;   // The number of pushes that replaced a pending item of the same key.
+    unsigned long long swept;       // The number of expired items removed by 'queueSweep'.
+    unsigned long long dropped;     // The number of pushes dropped because the buffer was full.
+    unsigned long long peak_bytes;  // The high-water mark of the bytes in use by a byte-budgeted engine.
+};
+
+/**
+ * How a queue lays out and touches its slots, for items larger than a few bytes.
+ */
+struct QueueLayout
+{
+    size_t slot_align; // A power of two each slot is padded and aligned to (0 packs the slots).
+    int prefetch;      // How many slots ahead of 'head' (or 'tail') to prefetch (0 disables prefetching).
+    size_t key_offset; // (Coalescing engines) The offset of the items' 32-bit key.
+    size_t expiry_offset; // (Sweeping) The offset of the items' 64-bit CLOCK_MONOTONIC expiry time in nanoseconds (0: never).
+    size_t size_offset;   // (Byte-budgeted engines) The offset of the items' 32-bit size in bytes (0: no size, every item is 'item_size' bytes).
+    size_t byte_budget;   // (Byte-budgeted engines) The capacity in bytes (0: room for 'capacity' items of 'item_size' bytes).
+};
+
+/**
+ * A bounded circular buffer of fixed size items.
+ *
+ * 'head' and 'tail' count the items ever removed and appended; they only grow, so the
+ * number of items in the buffer is their difference and the item at position 'p' lives in
+ * slot 'p & mask'. Which locks protect the counters depends on the engine.
+ *
+ * The slots are 'slot_size' bytes apart: 'item_size' rounded up to the layout's alignment,
+ * so that items written by different producers need not share a cache line. A
+ * byte-budgeted engine instead stores each item as a length-prefixed record of only its
+ * used bytes, one after the other in a ring of 'byte_budget' bytes.
+ *
+ * The fields written by producers and those written by consumers are padded onto
+ * separate cache lines, so that neither side invalidates the other's lines (or the
+ * read-mostly fields) on every operation.
+ */
+struct Queue
+{
+    const Engine *engine;
+    int BSIZE;        // The maximum size of the buffer.
+    size_t item_size; // The size of an item in bytes.
+    bool closed;      // Set by 'queueClose'; blocked and future pushes and pops fail.
+
+    unsigned char *buf;
+    uint64_t mask;       // The number of slots (BSIZE rounded up to a power of two) minus one.
+    size_t slot_size;    // The distance between two slots in bytes.
+    int prefetch;        // How many slots ahead the engines prefetch (0 for none).
+    size_t key_offset;   // (Coalescing engines) The offset of the items' 32-bit key (keyless items all share key 0).
+    size_t expiry_offset; // (Sweeping) The offset of the items' 64-bit expiry time (items too small for one never expire).
+    size_t size_offset;  // (Byte-budgeted engines) The offset of the items' 32-bit size (0 if every item uses 'item_size' bytes).
+    size_t byte_budget;  // (Byte-budgeted engines) The size of the ring of records in bytes.
+    uint64_t *index;     // (Coalescing engines) Position + 1 of the pending item of each key, by linear probing.
+    uint64_t index_mask; // (Coalescing engines) The number of entries of 'index' minus one.
+    uint64_t *published; // (Engines with several producers and no lock) Position + 1 of the item last written to each slot.
+
+    char producer_pad[QUEUE_CACHE_LINE];
+    uint64_t tail;
+    uint64_t cached_head; // (Lock-free engines) The producers' last copy of 'head'.
+    uint64_t tail_bytes;  // (Byte-budgeted engines) The number of bytes of records ever appended.
+    QueueSide producer;
+
+    char consumer_pad[QUEUE_CACHE_LINE];
+    uint64_t head;
+    uint64_t cached_tail; // (Lock-free engines) The consumer's last copy of 'tail'.
+    uint64_t head_bytes;  // (Byte-budgeted engines) The number of bytes of records ever removed.
+    QueueSide consumer;
+
+    char lock_pad[QUEUE_CACHE_LINE];
+    pthread_mutex_t producer_lock;
+    pthread_mutex_t consumer_lock;
+    pthread_cond_t producer_flag;
+    pthread_cond_t consumer_flag;
+
+    QueueObserver observer; // Optional; called from the engine on the calling thread.
+};
+
+/**
+ * A queue engine: the algorithm used to move items through a queue's buffer.
+ *
+ * 'pushBatch' and 'popBatch' move up to 'count' items while holding the lock once,
+ * blocking only until at least one item can be moved or, if 'deadline' (an absolute
+ * CLOCK_MONOTONIC time) is not NULL, until the deadline passes. They return the number of
+ * items moved: 0 once the queue is closed or the deadline passed. 'wake' releases every
+ * thread blocked in the engine after 'closed' is set. The optional 'init' and 'destroy'
+ * set up and release any state of the engine's own.
+ *
+ * A coalescing engine keeps at most one pending item per key: pushing an item whose key is
+ * pending overwrites that item in place (counted in 'coalesced') instead of appending it.
+ *
+ * A byte-budgeted engine bounds the bytes of records in its buffer rather than the number
+ * of items. When an item does not fit, a dropping engine discards it (counted in
+ * 'dropped') and reports it pushed instead of waiting for room.
+ *
+ * The optional 'sweep' removes up to 'count' items from the front of the buffer, without
+ * blocking, for as long as they expired before 'now'. Only engines that allow a second
+ * consumer beside the regular ones can sweep.
+ */
+struct Engine
+{
+    const char *name;
+    bool fifo;            // Whether the engine promises per-producer FIFO order.
+    bool single_producer; // Whether the engine only supports one producer thread.
+    bool single_consumer; // Whether the engine only supports one consumer thread.
+    bool coalescing;      // Whether the engine replaces pending items of the same key.
+    bool byte_budget;     // Whether the capacity is a number of bytes rather than of items.
+    bool dropping;        // Whether pushes drop the items that do not fit rather than wait.
+
+    bool (*init)(Queue *queue);
+    void (*destroy)(Queue *queue);
+    int (*pushBatch)(Queue *queue, const void *items, int count, const struct timespec *deadline);
+    int (*popBatch)(Queue *queue, void *items, int count, const struct timespec *deadline);
+    void (*wake)(Queue *queue);
+    int (*sweep)(Queue *queue, void *items, int count, int64_t now);
+};
+
+int queueSize(const Queue *queue);
+
+const Engine *findEngine(const char *name);
+const Engine *engineAt(int index);
+
+bool queueInit(Queue *queue, const Engine *engine, int capacity, size_t item_size, const QueueLayout *layout);
+void queueDestroy(Queue *queue);
+size_t queueFootprint(const Queue *queue);
+void queueClose(Queue *queue);
+void *queueSlot(const Queue *queue, uint64_t position);
+void queueStats(Queue *queue, QueueStats *stats, int *size);
+bool queuePush(Queue *queue, const void *item);
+bool queuePop(Queue *queue, void *item);
+int queuePushBatch(Queue *queue, const void *items, int count, const struct timespec *deadline);
+int queuePopBatch(Queue *queue, void *items, int count, const struct timespec *deadline);
+int queueSweep(Queue *queue, void *items, int count, int64_t now);
+int queuePeekBatch(Queue *queue, void *items, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // QUEUE_H
@@ -0,0 +1,679 @@
+/**
+ * Microbenchmarks for the queue engines, driven through the libpcqueue API.
+ *
+ * Measures the raw cost of the engines' operations without the simulator's sleeps,
+ * logging or configuration files. The benchmarks are:
+ *  - uncontended push/pop;
+ *  - ping-pong latency between two threads;
+ *  - N:M throughput;
+ *  - throughput as a function of the batch size and of the capacity;
+ *  - the number of loads of the other side's counter per item moved by the lock-free
+ *    engines;
+ *  - throughput as a function of the payload size and capacity, to compare slot layouts
+ *    with --slot-align and --prefetch.
+ *
+ * With --checksum, the producers of the throughput benchmarks fill every item and the
+ * consumers verify it, as bandwidth-bound consumers would. Benchmarks needing more
+ * producers (or consumers) than an engine supports are skipped. Every benchmark runs once
+ * to warm up, then '--reps' times; the median, minimum, maximum and median absolute
+ * deviation of the repetitions are reported.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc queue_bench.c pcqueue.c queue.c payload.c -O2 -lpthread -lm -o queue_bench
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./queue_bench [--engine=<NAME>]... [--reps=<N>] [--items=<N>] [--filter=<TEXT>]
+ *                      [--slot-align=<BYTES>] [--prefetch=<SLOTS>] [--checksum=<crc32c|xxhash>]
+ *                      [--kernel=<NAME>]
+ * e.g. ./queue_bench --engine=mutex --filter=throughput
+ *      ./queue_bench --engine=spsc --filter=payload --slot-align=64 --prefetch=2
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include "pcqueue.h"
+#include "payload.h"
+
+#define USAGE "Usage: ./queue_bench [--engine=<NAME>]... [--reps=<N>] [--items=<N>] [--filter=<TEXT>] [--slot-align=<BYTES>] [--prefetch=<SLOTS>] [--checksum=<crc32c|xxhash>] [--kernel=<NAME>]\n"
+#define MAX_ENGINES 16
+#define STALL_SECONDS 2 // The number of seconds without progress after which a run is considered wedged.
+
+typedef struct Payload Payload;
+typedef struct Run Run;
+typedef struct Benchmark Benchmark;
+
+/**
+ * The items moved by the benchmarks, which are the size of the simulator's items.
+ */
+struct Payload
+{
+    int value;
+    int producer_id;
+    unsigned int sequence;
+};
+
+/**
+ * The state shared by the threads of a single benchmark run.
+ */
+struct Run
+{
+    pcq_queue *queue;
+    pcq_queue *reply; // (Ping-pong) The queue carrying the items back.
+    int batch;        // The number of items moved per push or pop.
+    size_t item_size; // The size of the items in bytes.
+    long corrupt;     // The number of items failing their checksum.
+    long items;       // The number of items pushed by each producer.
+    long total;       // The number of items the consumers have to pop.
+    long consumed;
+    long long ended;  // The time at which the last item was popped.
+
+    pthread_barrier_t start;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_flag;
+};
+
+/**
+ * A benchmark: measures one sample of 'unit' for an engine.
+ */
+struct Benchmark
+{
+    const char *name;
+    const char *unit;
+    int producers;
+    int consumers;
+    int batch;
+    int capacity;
+    size_t item_size; // The size of the items in bytes (0 for a Payload).
+    double (*measure)(const char *engine, const Benchmark *benchmark, long items);
+};
+
+static double measureUncontended(const char *engine, const Benchmark *benchmark, long items);
+static double measurePingPong(const char *engine, const Benchmark *benchmark, long items);
+static double measureThroughput(const char *engine, const Benchmark *benchmark, long items);
+static double measureRemoteLoads(const char *engine, const Benchmark *benchmark, long items);
+
+static pcq_layout layout; // The slot layout of every queue (--slot-align and --prefetch).
+static const PayloadKernel *kernel; // The kernels filling and verifying the items (--kernel).
+static bool checked;                // Whether the items are filled and verified (--checksum).
+static PayloadChecksum checksum;
+
+static const Benchmark benchmarks[] = {
+    {"uncontended push+pop",           "ns/op",      1, 0, 1,  1024, 0,    measureUncontended},
+    {"uncontended batch 16",           "ns/op",      1, 0, 16, 1024, 0,    measureUncontended},
+    {"ping-pong round trip",           "ns/trip",    1, 1, 1,  1,    0,    measurePingPong},
+    {"throughput 1:1",                 "Mitems/s",   1, 1, 1,  1024, 0,    measureThroughput},
+    {"throughput 2:2",                 "Mitems/s",   2, 2, 1,  1024, 0,    measureThroughput},
+    {"throughput 4:4",                 "Mitems/s",   4, 4, 1,  1024, 0,    measureThroughput},
+    {"throughput 1:4",                 "Mitems/s",   1, 4, 1,  1024, 0,    measureThroughput},
+    {"throughput 4:1",                 "Mitems/s",   4, 1, 1,  1024, 0,    measureThroughput},
+    {"throughput 1:1 batch 4",         "Mitems/s",   1, 1, 4,  1024, 0,    measureThroughput},
+    {"throughput 1:1 batch 16",        "Mitems/s",   1, 1, 16, 1024, 0,    measureThroughput},
+    {"throughput 1:1 batch 64",        "Mitems/s",   1, 1, 64, 1024, 0,    measureThroughput},
+    {"throughput 1:1 capacity 1",      "Mitems/s",   1, 1, 1,  1,    0,    measureThroughput},
+    {"throughput 1:1 capacity 16",     "Mitems/s",   1, 1, 1,  16,   0,    measureThroughput},
+    {"throughput 1:1 capacity 256",    "Mitems/s",   1, 1, 1,  256,  0,    measureThroughput},
+    {"throughput 1:1 capacity 4096",   "Mitems/s",   1, 1, 1,  4096, 0,    measureThroughput},
+    {"remote loads 1:1 capacity 16",   "loads/item", 1, 1, 1,  16,   0,    measureRemoteLoads},
+    {"remote loads 1:1 capacity 256",  "loads/item", 1, 1, 1,  256,  0,    measureRemoteLoads},
+    {"remote loads 1:1 capacity 4096", "loads/item", 1, 1, 1,  4096, 0,    measureRemoteLoads},
+    {"remote loads 4:1 capacity 16",   "loads/item", 4, 1, 1,  16,   0,    measureRemoteLoads},
+    {"remote loads 4:1 capacity 256",  "loads/item", 4, 1, 1,  256,  0,    measureRemoteLoads},
+    {"remote loads 4:1 capacity 4096", "loads/item", 4, 1, 1,  4096, 0,    measureRemoteLoads},
+    {"payload 16 capacity 16",         "Mitems/s",   1, 1, 1,  16,   16,   measureThroughput},
+    {"payload 64 capacity 16",         "Mitems/s",   1, 1, 1,  16,   64,   measureThroughput},
+    {"payload 256 capacity 16",        "Mitems/s",   1, 1, 1,  16,   256,  measureThroughput},
+    {"payload 1024 capacity 16",       "Mitems/s",   1, 1, 1,  16,   1024, measureThroughput},
+    {"payload 16 capacity 1024",       "Mitems/s",   1, 1, 1,  1024, 16,   measureThroughput},
+    {"payload 64 capacity 1024",       "Mitems/s",   1, 1, 1,  1024, 64,   measureThroughput},
+    {"payload 256 capacity 1024",      "Mitems/s",   1, 1, 1,  1024, 256,  measureThroughput},
+    {"payload 1024 capacity 1024",     "Mitems/s",   1, 1, 1,  1024, 1024, measureThroughput},
+    {"payload 16 4:1 capacity 1024",   "Mitems/s",   4, 1, 1,  1024, 16,   measureThroughput},
+    {"payload 64 4:1 capacity 1024",   "Mitems/s",   4, 1, 1,  1024, 64,   measureThroughput},
+};
+
+/**
+ * Reads the monotonic clock.
+ *
+ * @return The current CLOCK_MONOTONIC time in nanoseconds.
+ */
+static long long now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Creates a queue with the selected slot layout, exiting on failure.
+ */
+static pcq_queue *createQueue(const char *engine, int capacity, size_t item_size)
+{
+    pcq_queue *queue;
+    pcq_status status = pcq_create_with_layout(&queue, engine, capacity, item_size, &layout);
+
+    if (status != PCQ_OK) {
+        fprintf(stderr, "pcq_create_with_layout: %s\n", pcq_status_string(status));
+        exit(1);
+    }
+
+    return queue;
+}
+
+/**
+ * Pushes all of the given items, as many at a time as the queue has room for.
+ *
+ * @return Whether every item was pushed (false once the queue is closed).
+ */
+static bool pushAll(pcq_queue *queue, const unsigned char *items, size_t count, size_t item_size)
+{
+    while (count > 0) {
+        size_t pushed;
+
+        if (pcq_push_batch(queue, items, count, &pushed) != PCQ_OK)
+            return false;
+
+        items += pushed * item_size;
+        count -= pushed;
+    }
+
+    return true;
+}
+
+/**
+ * Measures the cost of pushing and popping on a single thread, so that no lock is ever
+ * contended and no thread ever waits.
+ *
+ * @return The number of nanoseconds per item pushed and popped.
+ */
+static double measureUncontended(const char *engine, const Benchmark *benchmark, long items)
+{
+    pcq_queue *queue = createQueue(engine, benchmark->capacity, sizeof(Payload));
+    Payload batch[64];
+    long rounds = items / benchmark->batch;
+
+    memset(batch, 0, sizeof(batch));
+
+    long long started = now();
+
+    for (long i = 0; i < rounds; i++) {
+        pcq_push_batch(queue, batch, benchmark->batch, NULL);
+        pcq_pop_batch(queue, batch, benchmark->batch, NULL);
+    }
+
+    long long elapsed = now() - started;
+
+    pcq_destroy(queue);
+
+    return (double)elapsed / (rounds * benchmark->batch);
+}
+
+/**
+ * Waits for a run's threads to finish. A run that stops making progress is wedged: its
+ * queues are closed (repeatedly) until its threads give up.
+ *
+ * @return Whether the run completed.
+ */
+static bool awaitRun(Run *run, pthread_t *threads, int num_threads)
+{
+    long last_consumed = -1;
+    int idle = 0;
+
+    pthread_mutex_lock(&(run->done_lock));
+
+    while (run->consumed < run->total && idle < STALL_SECONDS) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += 1;
+
+        while (run->consumed < run->total && pthread_cond_timedwait(&(run->done_flag), &(run->done_lock), &deadline) != ETIMEDOUT);
+
+        idle = run->consumed == last_consumed ? idle + 1 : 0;
+        last_consumed = run->consumed;
+    }
+
+    bool completed = run->consumed >= run->total;
+
+    pthread_mutex_unlock(&(run->done_lock));
+
+    // Consumers that found nothing left to pop are blocked in the queue until it is closed.
+    for (int i = 0; i < num_threads; i++) {
+        pcq_close(run->queue);
+
+        if (run->reply)
+            pcq_close(run->reply);
+
+        pthread_join(threads[i], NULL);
+    }
+
+    return completed;
+}
+
+/**
+ * Records that the consumers popped 'count' more items, noting the time of the last one.
+ */
+static void consumed(Run *run, long count)
+{
+    if (__atomic_add_fetch(&run->consumed, count, __ATOMIC_RELAXED) < run->total)
+        return;
+
+    pthread_mutex_lock(&(run->done_lock));
+    run->ended = now();
+    pthread_cond_signal(&(run->done_flag));
+    pthread_mutex_unlock(&(run->done_lock));
+}
+
+/**
+ * The function used with the thread starting each round trip of the ping-pong benchmark.
+ */
+static void *ping(void *argv)
+{
+    Run *run = (Run *)argv;
+    Payload item;
+
+    memset(&item, 0, sizeof(item));
+    pthread_barrier_wait(&(run->start));
+
+    for (long i = 0; i < run->items; i++) {
+        if (pcq_push(run->queue, &item) != PCQ_OK || pcq_pop(run->reply, &item) != PCQ_OK)
+            break;
+
+        consumed(run, 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * The function used with the thread echoing each item of the ping-pong benchmark.
+ */
+static void *pong(void *argv)
+{
+    Run *run = (Run *)argv;
+    Payload item;
+
+    pthread_barrier_wait(&(run->start));
+
+    for (long i = 0; i < run->items; i++) {
+        if (pcq_pop(run->queue, &item) != PCQ_OK || pcq_push(run->reply, &item) != PCQ_OK)
+            break;
+    }
+
+    return NULL;
+}
+
+/**
+ * Fills the items of a batch: each item is its checksum, its seed, then the filled bytes.
+ */
+static void fillBatch(unsigned char *batch, size_t count, size_t item_size, uint32_t *seed)
+{
+    for (size_t i = 0; i < count; i++, batch += item_size) {
+        uint32_t sum;
+
+        (*seed)++;
+        kernel->fill(batch + 8, item_size - 8, *seed);
+        sum = payloadChecksum(kernel, checksum, batch + 8, item_size - 8, *seed);
+        memcpy(batch, &sum, 4);
+        memcpy(batch + 4, seed, 4);
+    }
+}
+
+/**
+ * Verifies the items of a batch filled by 'fillBatch'.
+ *
+ * @return The number of items failing their checksum.
+ */
+static long verifyBatch(const unsigned char *batch, size_t count, size_t item_size)
+{
+    long corrupt = 0;
+
+    for (size_t i = 0; i < count; i++, batch += item_size) {
+        uint32_t sum, seed;
+
+        memcpy(&sum, batch, 4);
+        memcpy(&seed, batch + 4, 4);
+        corrupt += payloadChecksum(kernel, checksum, batch + 8, item_size - 8, seed) != sum;
+    }
+
+    return corrupt;
+}
+
+/**
+ * The function used with the producer threads of the throughput benchmarks.
+ */
+static void *produce(void *argv)
+{
+    Run *run = (Run *)argv;
+    unsigned char *batch = (unsigned char *)calloc(run->batch, run->item_size);
+    uint32_t seed = (uint32_t)(uintptr_t)&seed;
+
+    if (!batch) {
+        perror("calloc");
+        exit(1);
+    }
+
+    pthread_barrier_wait(&(run->start));
+
+    for (long i = 0; i < run->items; i += run->batch) {
+        size_t count = run->items - i < run->batch ? (size_t)(run->items - i) : (size_t)run->batch;
+
+        if (checked)
+            fillBatch(batch, count, run->item_size, &seed);
+
+        if (!pushAll(run->queue, batch, count, run->item_size))
+            break;
+    }
+
+    free(batch);
+
+    return NULL;
+}
+
+/**
+ * The function used with the consumer threads of the throughput benchmarks.
+ */
+static void *consume(void *argv)
+{
+    Run *run = (Run *)argv;
+    unsigned char *batch = (unsigned char *)malloc(run->batch * run->item_size);
+
+    if (!batch) {
+        perror("malloc");
+        exit(1);
+    }
+
+    pthread_barrier_wait(&(run->start));
+
+    while (__atomic_load_n(&run->consumed, __ATOMIC_RELAXED) < run->total) {
+        size_t popped;
+
+        if (pcq_pop_batch(run->queue, batch, run->batch, &popped) != PCQ_OK)
+            break;
+
+        if (checked)
+            __atomic_add_fetch(&run->corrupt, verifyBatch(batch, popped, run->item_size), __ATOMIC_RELAXED);
+
+        consumed(run, popped);
+    }
+
+    free(batch);
+
+    return NULL;
+}
+
+/**
+ * Runs the threads of a benchmark and times them from the moment they are all released
+ * until the last item is consumed.
+ *
+ * @return The elapsed time in nanoseconds, or a negative number if the run wedged.
+ */
+static long long timeRun(Run *run, int num_threads, void *(*functions[])(void *))
+{
+    pthread_t threads[num_threads];
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_barrier_init(&(run->start), NULL, num_threads + 1);
+    pthread_mutex_init(&(run->done_lock), NULL);
+    pthread_cond_init(&(run->done_flag), &attr);
+    pthread_condattr_destroy(&attr);
+
+    for (int i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, functions[i], run);
+
+    pthread_barrier_wait(&(run->start));
+
+    long long started = now();
+    bool completed = awaitRun(run, threads, num_threads);
+
+    pthread_barrier_destroy(&(run->start));
+    pthread_mutex_destroy(&(run->done_lock));
+    pthread_cond_destroy(&(run->done_flag));
+
+    return completed ? run->ended - started : -1;
+}
+
+/**
+ * Measures the round trip latency between two threads exchanging a single item through two
+ * queues of capacity one, so every handoff wakes the other thread.
+ *
+ * @return The number of nanoseconds per round trip.
+ */
+static double measurePingPong(const char *engine, const Benchmark *benchmark, long items)
+{
+    Run run;
+    void *(*functions[])(void *) = {ping, pong};
+
+    memset(&run, 0, sizeof(run));
+    run.items = items / 10 > 0 ? items / 10 : 1;
+    run.total = run.items;
+
+    run.queue = createQueue(engine, benchmark->capacity, sizeof(Payload));
+    run.reply = createQueue(engine, benchmark->capacity, sizeof(Payload));
+
+    long long elapsed = timeRun(&run, 2, functions);
+
+    pcq_destroy(run.queue);
+    pcq_destroy(run.reply);
+
+    return elapsed < 0 ? NAN : (double)elapsed / run.items;
+}
+
+/**
+ * Moves items from the benchmark's producers to its consumers.
+ *
+ * @param stats Receives the queue's counters once the run is over.
+ *
+ * @return The duration of the run in nanoseconds, or -1 if it wedged.
+ */
+static long long transferItems(const char *engine, const Benchmark *benchmark, long items, pcq_stats *stats)
+{
+    Run run;
+    int num_threads = benchmark->producers + benchmark->consumers;
+    void *(*functions[num_threads])(void *);
+
+    memset(&run, 0, sizeof(run));
+    run.batch = benchmark->batch;
+    run.item_size = benchmark->item_size ? benchmark->item_size : sizeof(Payload);
+    run.items = items / benchmark->producers;
+    run.total = run.items * benchmark->producers;
+
+    for (int i = 0; i < num_threads; i++)
+        functions[i] = i < benchmark->producers ? produce : consume;
+
+    run.queue = createQueue(engine, benchmark->capacity, run.item_size);
+
+    long long elapsed = timeRun(&run, num_threads, functions);
+
+    if (run.corrupt) {
+        fprintf(stderr, "%s: %ld items failed their checksum.\n", engine, run.corrupt);
+        exit(1);
+    }
+
+    pcq_get_stats(run.queue, stats, sizeof(pcq_stats));
+    pcq_destroy(run.queue);
+
+    return elapsed;
+}
+
+/**
+ * Measures the number of items moved per second from the benchmark's producers to its
+ * consumers.
+ *
+ * @return The throughput in millions of items per second.
+ */
+static double measureThroughput(const char *engine, const Benchmark *benchmark, long items)
+{
+    pcq_stats stats;
+    long long elapsed = transferItems(engine, benchmark, items, &stats);
+
+    return elapsed < 0 ? NAN : stats.popped * 1000.0 / elapsed;
+}
+
+/**
+ * Counts the loads of the other side's counter (the cache line the other side writes) per
+ * item moved; the engines that do not count them report 0.
+ */
+static double measureRemoteLoads(const char *engine, const Benchmark *benchmark, long items)
+{
+    pcq_stats stats;
+    long long elapsed = transferItems(engine, benchmark, items, &stats);
+
+    return elapsed < 0 ? NAN : (double)(stats.head_loads + stats.tail_loads) / stats.popped;
+}
+
+/**
+ * Orders doubles in ascending order (for qsort).
+ */
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Runs a benchmark on an engine and prints a row of statistics over its repetitions.
+ */
+static void report(const char *engine, const Benchmark *benchmark, int reps, long items)
+{
+    double samples[reps];
+    double deviations[reps];
+
+    benchmark->measure(engine, benchmark, items); // Warm up.
+
+    for (int i = 0; i < reps; i++) {
+        samples[i] = benchmark->measure(engine, benchmark, items);
+
+        if (isnan(samples[i])) {
+            printf("%-14s %-30s %10s\n", engine, benchmark->name, "wedged");
+            return;
+        }
+    }
+
+    qsort(samples, reps, sizeof(double), compareDoubles);
+
+    double median = reps % 2 ? samples[reps / 2] : (samples[reps / 2 - 1] + samples[reps / 2]) / 2;
+
+    for (int i = 0; i < reps; i++)
+        deviations[i] = fabs(samples[i] - median);
+
+    qsort(deviations, reps, sizeof(double), compareDoubles);
+
+    double mad = reps % 2 ? deviations[reps / 2] : (deviations[reps / 2 - 1] + deviations[reps / 2]) / 2;
+
+    printf("%-14s %-30s %10.2f %10.2f %10.2f %7.1f%%  %s\n", engine, benchmark->name, median, samples[0], samples[reps - 1], median ? 100 * mad / median : 0, benchmark->unit);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    size_t selected[MAX_ENGINES];
+    int num_selected = 0;
+    int reps = 5;
+    long items = 200000;
+    const char *filter = NULL;
+    const char *kernel_name = "auto";
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            const char *engine = argv[i] + 9;
+            size_t e = 0;
+
+            while (pcq_engine_name(e) && strcmp(pcq_engine_name(e), engine) != 0)
+                e++;
+
+            if (!pcq_engine_name(e)) {
+                fprintf(stderr, "Unknown engine '%s'.\n\n" USAGE, argv[i] + 9);
+                exit(1);
+            }
+
+            // The benchmarks count items, some of which a coalescing engine would merge (or a
+            // dropping engine discard).
+            if (pcq_engine_flags(e) & (PCQ_ENGINE_COALESCING | PCQ_ENGINE_DROPPING)) {
+                fprintf(stderr, "Engine '%s' coalesces or drops items and cannot be benchmarked.\n", engine);
+                exit(1);
+            }
+
+            if (num_selected < MAX_ENGINES)
+                selected[num_selected++] = e;
+        } else if (strncmp(argv[i], "--reps=", 7) == 0) {
+            reps = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--items=", 8) == 0) {
+            items = atol(argv[i] + 8);
+        } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        } else if (strncmp(argv[i], "--slot-align=", 13) == 0) {
+            layout.slot_align = strtoul(argv[i] + 13, NULL, 10);
+        } else if (strncmp(argv[i], "--prefetch=", 11) == 0) {
+            layout.prefetch = strtoul(argv[i] + 11, NULL, 10);
+        } else if (strncmp(argv[i], "--checksum=", 11) == 0) {
+            checked = findPayloadChecksum(argv[i] + 11, &checksum);
+
+            if (!checked) {
+                fprintf(stderr, "Unknown checksum '%s'.\n\n" USAGE, argv[i] + 11);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--kernel=", 9) == 0) {
+            kernel_name = argv[i] + 9;
+        } else {
+            fprintf(stderr, "Unknown option '%s'.\n\n" USAGE, argv[i]);
+            exit(1);
+        }
+    }
+
+    if (reps < 1 || items < 1) {
+        fputs("--reps and --items must be positive.\n\n" USAGE, stderr);
+        exit(1);
+    }
+
+    kernel = findPayloadKernel(kernel_name);
+
+    if (!kernel) {
+        fprintf(stderr, "Unknown or unsupported payload kernel '%s'.\n\n" USAGE, kernel_name);
+        exit(1);
+    }
+
+    // Every engine except the racy "legacy" one and the coalescing and dropping ones is
+    // benchmarked unless engines are selected.
+    if (num_selected == 0) {
+        for (size_t i = 0; pcq_engine_name(i) && num_selected < MAX_ENGINES; i++) {
+            if (strcmp(pcq_engine_name(i), "legacy") != 0 && !(pcq_engine_flags(i) & (PCQ_ENGINE_COALESCING | PCQ_ENGINE_DROPPING)))
+                selected[num_selected++] = i;
+        }
+    }
+
+    printf("queue_bench: %d repetitions after a warm-up, %ld items per repetition, slot alignment %zu, prefetch %u, checksum %s (%s)\n", reps, items, layout.slot_align, layout.prefetch, checked ? payloadChecksumName(checksum) : "none", kernel->name);
+    printf("%-14s %-30s %10s %10s %10s %8s  %s\n", "engine", "benchmark", "median", "min", "max", "mad", "unit");
+
+    for (int e = 0; e < num_selected; e++) {
+        int flags = pcq_engine_flags(selected[e]);
+
+        for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+            if (filter && !strstr(benchmarks[b].name, filter))
+                continue;
+
+            if ((flags & PCQ_ENGINE_SINGLE_PRODUCER && benchmarks[b].producers > 1) || (flags & PCQ_ENGINE_SINGLE_CONSUMER && benchmarks[b].consumers > 1))
+                continue;
+
+            report(pcq_engine_name(selected[e]), &benchmarks[b], reps, items);
+        }
+    }
+
+    return 0;
+}
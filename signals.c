@@ -0,0 +1,215 @@
+/**
+ * Signal control of a running simulation: SIGUSR1 prints a snapshot of the running test
+ * case's counters, without pausing its threads, and SIGINT terminates the running test case
+ * early (through the same path as its deadline), so that its results are still verified and
+ * printed, and then ends the run. A second SIGINT exits immediately.
+ *
+ * The signals are blocked in every thread and handled by a dedicated thread with 'sigwait',
+ * so that the snapshot can use stdio and locks. With '--isolate', the parent forwards the
+ * signals to the child running the current test case.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "simulator.h"
+
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER;
+static TestCase *current = NULL; // The test case whose threads are running (NULL between test cases).
+static pid_t current_child = 0;  // (With '--isolate') The child process running the current test case.
+static bool stop_requested = false;
+
+/**
+ * Prints a snapshot of a running test case's counters.
+ *
+ * The counters are read with relaxed atomic loads while the threads keep running, so the
+ * totals are only consistent to within the items moved while they are being read.
+ *
+ * @param test_case The running test case.
+ */
+void printSnapshot(TestCase *test_case)
+{
+    static const char *states[] = {"running", "acquiring", "waiting on full", "waiting on empty", "sleeping", "exited"};
+
+    unsigned long produced = 0;
+    unsigned long consumed = 0;
+    unsigned long expired = 0;
+    int in_state[WORKER_EXITED + 1] = {0};
+    Latency merged;
+    double elapsed = (now() - test_case->started) / 1e9;
+
+    memset(&merged, 0, sizeof(merged));
+
+    for (int i = 0; i < test_case->num_workers; i++) {
+        Worker *worker = &test_case->workers[i];
+        unsigned long operations = __atomic_load_n(&worker->operations, __ATOMIC_RELAXED);
+
+        in_state[__atomic_load_n(&worker->state, __ATOMIC_RELAXED)]++;
+
+        if (worker->is_producer) {
+            produced += operations;
+            continue;
+        }
+
+        consumed += operations;
+        expired += __atomic_load_n(&worker->expired, __ATOMIC_RELAXED);
+        mergeLatency(&merged, &worker->latency);
+    }
+
+    printf("\tSnapshot at %.1f s: produced = %lu, consumed = %lu, expired = %lu, in flight = %ld, throughput = %.1f items/s", elapsed, produced, consumed, expired,
+           (long)(produced - consumed - expired), elapsed > 0 ? consumed / elapsed : 0);
+
+    if (merged.samples)
+        printf(", p50 <= %.3f ms, p99 <= %.3f ms", latencyPercentile(&merged, 0.5) / 1e6, latencyPercentile(&merged, 0.99) / 1e6);
+
+    printf(", threads:");
+
+    for (int state = 0; state <= WORKER_EXITED; state++) {
+        if (in_state[state])
+            printf(" %d %s", in_state[state], states[state]);
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * The function used with the signal thread.
+ */
+static void *handleSignals(void *argv)
+{
+    sigset_t *signals = (sigset_t *)argv;
+
+    while (true) {
+        int signal;
+
+        if (sigwait(signals, &signal) != 0)
+            continue;
+
+        pthread_mutex_lock(&current_lock);
+
+        if (current_child > 0) {
+            kill(current_child, signal);
+        } else if (signal == SIGUSR1) {
+            if (current)
+                printSnapshot(current);
+            else
+                printf("\tSnapshot: no test case is running\n");
+        }
+
+        if (signal == SIGINT) {
+            if (stop_requested) {
+                if (current_child > 0)
+                    kill(current_child, SIGKILL);
+
+                fputs("Interrupted again, exiting.\n", stderr);
+                fflush(stdout);
+                _exit(130);
+            }
+
+            stop_requested = true;
+
+            if (current) {
+                printf("\tInterrupted: stopping the test case early\n");
+
+                pthread_mutex_lock(&(current->done_lock));
+                current->terminated = true;
+                pthread_cond_broadcast(&(current->done_flag));
+                pthread_mutex_unlock(&(current->done_lock));
+            }
+
+            fflush(stdout);
+        }
+
+        pthread_mutex_unlock(&current_lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Blocks SIGUSR1 and SIGINT and starts the thread handling them.
+ *
+ * Must be called before the calling process creates any other thread, so that they all
+ * inherit the blocked signals.
+ *
+ * @return Whether the signal thread could be started.
+ */
+bool startSignalThread(void)
+{
+    static sigset_t signals;
+    pthread_t thread;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGINT);
+
+    // A forked child may have inherited the lock held by its parent's signal thread.
+    pthread_mutex_init(&current_lock, NULL);
+    pthread_mutex_lock(&current_lock);
+    current = NULL;
+    current_child = 0;
+    pthread_mutex_unlock(&current_lock);
+
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0 || pthread_create(&thread, NULL, handleSignals, &signals) != 0) {
+        perror("pthread_create");
+        return false;
+    }
+
+    pthread_detach(thread);
+
+    return true;
+}
+
+/**
+ * Makes a test case the target of the signals, or clears the target.
+ *
+ * @param test_case The test case whose threads are running, with an initialized 'done_lock'
+ * and 'done_flag', or NULL once its threads have been joined.
+ */
+void watchTestCase(TestCase *test_case)
+{
+    pthread_mutex_lock(&current_lock);
+    current = test_case;
+    pthread_mutex_unlock(&current_lock);
+
+    // A stop requested before the test case started applies to it as well.
+    if (test_case && stopRequested()) {
+        pthread_mutex_lock(&(test_case->done_lock));
+        test_case->terminated = true;
+        pthread_cond_broadcast(&(test_case->done_flag));
+        pthread_mutex_unlock(&(test_case->done_lock));
+    }
+}
+
+/**
+ * Makes a child process the target of the signals, or clears the target.
+ *
+ * @param child The child process running the current test case, or 0.
+ */
+void watchChild(pid_t child)
+{
+    pthread_mutex_lock(&current_lock);
+    current_child = child;
+    pthread_mutex_unlock(&current_lock);
+}
+
+/**
+ * Determines whether SIGINT was received.
+ *
+ * @return Whether the run should stop after the current test case.
+ */
+bool stopRequested(void)
+{
+    pthread_mutex_lock(&current_lock);
+    bool requested = stop_requested;
+    pthread_mutex_unlock(&current_lock);
+
+    return requested;
+}
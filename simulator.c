@@ -3,75 +3,144 @@
  *
  * To properly compile this program see COMPILE:
  *
- * COMPILE: gcc simulator.c -lpthread -o simulator
+ * COMPILE: g++ -std=c++17 -c bounded.cpp && gcc simulator.c stress.c keyed.c latency.c expiry.c batch.c pool.c isolate.c signals.c threads.c slo.c fault.c clock.c queue.c payload.c bounded.o -lpthread -lstdc++ -lm -o simulator
  *
  * To properly use this program see USAGE:
  *
- * USAGE: ./simulator <PATH_TO_CONFIG_FILE> <MAX_TEST_CASE_DURATION>
+ * USAGE: ./simulator <PATH_TO_CONFIG_FILE> <MAX_TEST_CASE_DURATION> [OPTIONS]
  * e.g. ./simulator "config.txt" 10
  *
+ * OPTIONS:
+ *  --watchdog=<SECONDS>  Report a stall (with a dump of every thread's state) when no item
+ *                        is produced or consumed for the given number of seconds.
+ *  --watchdog-abort      Abort the current test case when the watchdog detects a stall.
+ *  --stress=<ROUNDS>     Instead of simulating, run the linearizability stress harness for
+ *                        the given number of rounds on each test case's engine.
+ *  --stress-ops=<N>      The number of items each producer pushes per stress round (default 200).
+ *  --template=<WAIT>     Instead of simulating, run each test case's threads flat out against
+ *                        the pcq::BoundedQueue instantiation matching it, waiting with the
+ *                        given policy ("spin", "yield" or "block").
+ *  --queues=<K[,K...]>   Instead of simulating, run each test case as K independent buffers
+ *                        (once per K given) served by a pool of its producers and consumers
+ *                        running flat out, reporting the memory, throughput and wake-ups per
+ *                        buffer. Only the engine and BSIZE columns are used.
+ *  --slo=<P99_MS>        Instead of simulating once, search the highest rate (see 'rate') at
+ *                        which each test case keeps its p99 latency within the given number
+ *                        of milliseconds without losing items, running it at every rate probed.
+ *  --slo-repeats=<N>     The number of runs per rate (or plan) probed, of which most must pass
+ *                        (default 3).
+ *  --plan=<P99_MS>       Instead of simulating once, search the fewest consumers and then the
+ *                        smallest power of two BSIZE with which each test case meets the given
+ *                        p99 latency at its 'rate' and 'service' time, and print it as a row.
+ *  --plan-max-consumers=<N>
+ *                        The most consumers a plan may use (default 32).
+ *  --isolate[=<SECONDS>] Run every test case in a child process of its own, killing it if it
+ *                        runs longer than the given number of seconds (default: twice the
+ *                        test case duration plus 10 s per run), and print a summary of the
+ *                        results of every test case at the end.
+ *  --kernel=<NAME>       The payload kernels ("auto", "avx2", "sse4.2", "neon" or "portable",
+ *                        default "auto": the fastest one the CPU supports).
+ *  --clock=<NAME>        The clock timestamping items and timing waits: "tsc" (the CPU's
+ *                        time-stamp counter, calibrated against CLOCK_MONOTONIC at startup),
+ *                        "monotonic" (clock_gettime) or "auto" (default: "tsc" if the TSC is
+ *                        invariant, "monotonic" otherwise).
+ *  --seed=<N>            The seed from which every producer and consumer derives its random
+ *                        numbers (its sleeps, service times, items, keys and payload sizes),
+ *                        so that a run can be repeated, and rows differing only in their
+ *                        engine see the same offered load (default: the current time). The
+ *                        seed is printed when the run starts.
+ *
+ * Each row of the configuration file may append optional '<KEY>=<VALUE>' columns:
+ *  engine=<NAME>         The queue engine to use ("legacy", "mutex", "spsc", "spsc-uncached",
+ *                        "mpsc", "mpsc-uncached", "coalesce", "bytes" or "bytes-drop",
+ *                        default "legacy"). With "coalesce", an item replaces the pending
+ *                        item of its key; "bytes" and "bytes-drop" budget the buffer in
+ *                        bytes, and block (or drop items) when it is exceeded.
+ *  slot_align=<BYTES>    Pad and align each slot of the buffer to the given power of two,
+ *                        e.g. 64 to give every item its own cache line (default 0: packed).
+ *  prefetch=<SLOTS>      Prefetch the slot this many positions ahead of each push (for
+ *                        writing) and pop (for reading) (default 0: no prefetching).
+ *  payload=<BYTES>       Make producers fill (and consumers verify) a payload of the given
+ *                        size after each item (default 0: no payload).
+ *  checksum=<NAME>       How payloads are verified: "crc32c" or "xxhash" (default "crc32c").
+ *  payload_min=<BYTES>   Draw the size of each payload uniformly between this and 'payload'
+ *                        (default 0: every payload has the size 'payload').
+ *  budget=<BYTES>        (With the "bytes" and "bytes-drop" engines) The capacity of the
+ *                        buffer in bytes (default: room for BSIZE items of the largest size).
+ *  keys=<N>              Give every item one of N keys and route each key to a single
+ *                        consumer through per-consumer partitions (default 0: one buffer).
+ *  zipf=<S>              The Zipf exponent of the keys' popularity (default 1; 0 for uniform).
+ *  ttl=<MS>              Make items stale the given number of milliseconds after they are
+ *                        pushed; consumers discard stale items unprocessed (default 0: never).
+ *  sweep=<MS>            (With a TTL) Also remove the stale items at the front of the buffer
+ *                        every given number of milliseconds (default 0: no sweeper).
+ *  batch=<N>             Make consumers collect up to N items before processing them, with a
+ *                        single sleep per batch (default 1: no batching).
+ *  linger=<US>           (With a batch) How long a consumer waits for its batch to fill after
+ *                        its first item, in microseconds (default 0: only what is available).
+ *  rate=<ITEMS/S>        Make the producers together offer this many items per second, at
+ *                        regular intervals, instead of sleeping (default 0: sleep).
+ *  service=<US>          Make consumers take this many microseconds per item processed instead
+ *                        of sleeping (default 0: sleep).
+ *  service_dist=<NAME>   How the service time is distributed: "fixed", "exp" (exponential with
+ *                        mean 'service') or "uniform" (between 0 and twice 'service')
+ *                        (default "fixed").
+ *  stack=<KB>            The stack size of the producer and consumer threads, in KiB (default:
+ *                        the system's, usually 8192).
+ *  guard=<KB>            The size of the guard area below each thread's stack, in KiB (default:
+ *                        the system's, usually one page; 0 for none).
+ *  producer_sched=<NAME> The scheduling policy of the producer threads: "other", "batch",
+ *                        "idle", "fifo" or "rr" (default "other"). A policy the system
+ *                        refuses (e.g. "fifo" without the privilege) leaves the threads on
+ *                        "other" and is reported.
+ *  producer_priority=<N> (With "fifo" or "rr") The producers' static priority (default: the
+ *                        lowest).
+ *  producer_nice=<N>     The producers' nice level, from -20 to 19 (default 0).
+ *  consumer_sched=<NAME>, consumer_priority=<N>, consumer_nice=<N>
+ *                        The same for the consumer threads.
+ *  fault=<NAME>          Inject a fault into the run: "freeze" stops the first consumer,
+ *                        "burst" makes the first producer 'fault_factor' times faster and
+ *                        "slow" makes the first consumer 'fault_factor' times slower; then
+ *                        report the buffer's peak depth and recovery time and the latency of
+ *                        the items pushed before, during and after it (default "none").
+ *  fault_at=<MS>         When the fault begins, in milliseconds after the start (default 1000).
+ *  fault_for=<MS>        How long the fault lasts, in milliseconds (default 1000).
+ *  fault_factor=<N>      How many times faster a burst or slower a slowdown is (default 100).
+ *
+ * SIGNALS:
+ *  SIGUSR1               Print a snapshot of the running test case's counters.
+ *  SIGINT                Stop the running test case early, print its results and exit (a
+ *                        second SIGINT exits immediately).
+ *
  * @author Nicholas Adamou
  * @date 12/7/2019
  */
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdbool.h>
 #include <string.h>
-#include <pthread.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <math.h>
 
-typedef struct TestCase TestCase;
-
-/**
- * Represents a given test case associated with each line within the given configuration file.
- */
-struct TestCase
-{
-    int BSIZE;					 // The maximum size of the buffer.
-    int producer_sleep_duration; // The amount of time a producer should sleep for.
-    int consumer_sleep_duration; // The amount of time a consumer should sleep for.
-    bool terminated;
+#include "simulator.h"
 
-    int *buf;
-    int front;
-    int rear;
+#define MAX_LINE_LENGTH 1024 // The longest row of the configuration file, including its options.
 
-    pthread_mutex_t producer_lock;
-    pthread_mutex_t consumer_lock;
-    pthread_cond_t producer_flag;
-    pthread_cond_t consumer_flag;
-};
-
-int size(int front, int rear, int capacity);
-
-char **split(char *str, char tokens);
-char **readFile(char * path, int number_of_lines);
-int numberOfLinesInFile(char * path);
-
-void *produce(void *argv);
-void *consume(void *argv);
-void execute(int test_case_number, int duration, int num_producers, int num_consumers, TestCase *test_case);
+#define USAGE "ProducerConsumerTests\nUsage: ./ProducerConsumerTests <PATH_TO_CONFIG_FILE> <MAX_TEST_CASE_DURATION> [--watchdog=<SECONDS>] [--watchdog-abort] [--stress=<ROUNDS>] [--stress-ops=<N>] [--template=<WAIT>] [--queues=<K[,K...]>] [--slo=<P99_MS>] [--slo-repeats=<N>] [--plan=<P99_MS>] [--plan-max-consumers=<N>] [--isolate[=<SECONDS>]] [--kernel=<NAME>] [--clock=<NAME>] [--seed=<N>]\n"
 
 /**
- * Determines the size of the given buffer (thread safe).
+ * Publishes the current state of a worker thread to the watchdog.
  *
- * @param front The index of the front element of the buffer.
- * @param rear The index of the rear element of the buffer.
- * @param capacity The capacity of the buffer.
- *
- * @return The size of the buffer.
+ * @param worker The worker whose state changed.
+ * @param state The new state of the worker.
+ * @param lock The lock the worker now holds (or is acquiring).
  */
-int size(int front, int rear, int capacity)
+void setWorkerState(Worker *worker, WorkerState state, QueueLock lock)
 {
-    if (front == -1)
-        return 0;
-
-    if (front >= rear)
-        return (rear + capacity) - front;
-
-    return rear - front;
+    __atomic_store_n(&worker->state, state, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->lock, lock, __ATOMIC_RELAXED);
 }
 
 /**
@@ -134,6 +203,23 @@ char **split(char *str, const char separator)
     return result;
 }
 
+/**
+ * Removes trailing whitespace (such as the line's newline) from a string in place.
+ *
+ * @param str The string to trim.
+ *
+ * @return The trimmed string.
+ */
+char *trim(char *str)
+{
+    size_t length = strlen(str);
+
+    while (length > 0 && (str[length - 1] == '\n' || str[length - 1] == '\r' || str[length - 1] == ' ' || str[length - 1] == '\t'))
+        str[--length] = 0;
+
+    return str;
+}
+
 /**
  * Counts the number of lines within a given file.
  *
@@ -150,9 +236,9 @@ int numberOfLinesInFile(char *path) {
     }
 
     int number_of_lines = 0;
-    char buf[100];
+    char buf[MAX_LINE_LENGTH];
 
-    while(fgets(buf, 100, file) != NULL) {
+    while(fgets(buf, MAX_LINE_LENGTH, file) != NULL) {
         number_of_lines++;
     }
 
@@ -187,14 +273,14 @@ char **readFile(char *path, int number_of_lines) {
     }
 
     for (int i = 0; i < number_of_lines; i++) {
-        data[i] = (char *)malloc(sizeof(char) * 100);
+        data[i] = (char *)malloc(sizeof(char) * MAX_LINE_LENGTH);
 
         if (!data[i]) {
             perror("malloc");
             continue;
         }
 
-        fgets(data[i], 100, file);
+        fgets(data[i], MAX_LINE_LENGTH, file);
     }
 
     fclose(file);
@@ -202,105 +288,807 @@ char **readFile(char *path, int number_of_lines) {
     return data;
 }
 
+/**
+ * The worker running on the calling thread (NULL on threads other than producers and
+ * consumers), used to attribute the queue's events to a worker.
+ */
+static __thread Worker *self;
+
+/**
+ * The queue observer of the simulator: publishes what the calling worker is doing inside
+ * the engine to the watchdog and logs when it has to wait.
+ *
+ * @param queue The queue reporting the event.
+ * @param event What the calling thread is doing.
+ * @param lock The lock the calling thread holds (or is acquiring).
+ */
+void observe(const Queue *queue, QueueEvent event, QueueLock lock)
+{
+    Worker *worker = self;
+
+    (void)queue;
+
+    if (!worker)
+        return;
+
+    switch (event)
+    {
+        case QUEUE_ACQUIRING:
+            setWorkerState(worker, WORKER_ACQUIRING, lock);
+            break;
+        case QUEUE_ACQUIRED:
+        case QUEUE_RELEASED:
+            setWorkerState(worker, WORKER_RUNNING, lock);
+            break;
+        case QUEUE_WAITING_FULL:
+            if (!worker->test_case->quiet)
+                printf("\tQueue is full, cannot produce, waiting for consumer\n");
+
+            setWorkerState(worker, WORKER_WAITING_FULL, lock);
+            break;
+        case QUEUE_WAITING_EMPTY:
+            if (!worker->test_case->quiet)
+                printf("\tQueue is empty, cannot consume, waiting for producer\n");
+
+            setWorkerState(worker, WORKER_WAITING_EMPTY, lock);
+            break;
+    }
+}
+
+/**
+ * Derives the seed of an item's payload, so that payloads differ from item to item.
+ */
+static uint32_t payloadSeed(Item item)
+{
+    return item.sequence * 0x9E3779B1u ^ (uint32_t)item.producer_id;
+}
+
+/**
+ * Sleeps until a CLOCK_MONOTONIC time, in nanoseconds (returns at once if it has passed).
+ */
+static void sleepUntil(long long time)
+{
+    struct timespec deadline = {time / 1000000000LL, time % 1000000000LL};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+/**
+ * Names a service time distribution.
+ *
+ * @param distribution The distribution.
+ *
+ * @return Its name, as given by the 'service_dist' option.
+ */
+const char *serviceDistributionName(ServiceDistribution distribution)
+{
+    static const char *names[] = {"fixed", "exp", "uniform"};
+
+    return names[distribution];
+}
+
+/**
+ * Derives the seed of one of a worker's random number streams from the run's seed (with
+ * SplitMix64), so that every worker draws the same numbers in every run with that seed,
+ * whatever the engine, the other rows or the interleaving of the threads.
+ *
+ * @param seed The run's seed.
+ * @param worker The producer or consumer.
+ * @param stream The stream.
+ *
+ * @return The seed of the stream, for 'rand_r'.
+ */
+unsigned int deriveSeed(unsigned long long seed, const Worker *worker, RandomStream stream)
+{
+    uint64_t index = ((uint64_t)worker->id * 2 + !worker->is_producer) * (RANDOM_ITEMS + 1) + stream;
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (index + 1);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return (unsigned int)(z ^ (z >> 31));
+}
+
+/**
+ * Draws the time a consumer takes to process an item from the test case's distribution.
+ *
+ * @param test_case The test case.
+ * @param seed The state of the consumer's RANDOM_SERVICE stream.
+ *
+ * @return The service time in nanoseconds.
+ */
+static long long drawServiceTime(const TestCase *test_case, unsigned int *seed)
+{
+    double u = (rand_r(seed) + 1.0) / ((double)RAND_MAX + 2.0); // Uniform in (0, 1).
+
+    switch (test_case->service_distribution) {
+        case SERVICE_EXPONENTIAL: return (long long)(-log(u) * test_case->service_time);
+        case SERVICE_UNIFORM: return (long long)(2 * u * test_case->service_time);
+        case SERVICE_FIXED: break;
+    }
+
+    return test_case->service_time;
+}
+
 /**
  * The function used with a producer thread.
  *
- * Appends a random number to the end of the queue
- * locks all other producer threads while this producer is producing,
- * signals to the next consumer to start consuming, then unlocks the
- * producer lock so other producers can produce and sleeps for x seconds.
+ * Appends a random number (followed by the test case's payload, if any) to the end of the
+ * queue using the test case's engine, then sleeps for x seconds.
  *
- * @param argv The arguments passed to the producer thread.
+ * @param argv The producer's worker.
  */
 void *produce(void *argv)
 {
-    TestCase *test_case = (TestCase *)argv;
-    int *buf = test_case->buf;
+    Worker *worker = (Worker *)argv;
+    TestCase *test_case = worker->test_case;
+    unsigned char *record = (unsigned char *)malloc(test_case->queue.item_size);
+    int num_producers = test_case->num_producers;
+    long long interval = test_case->rate > 0 ? (long long)(1e9 * num_producers / test_case->rate) : 0;
+    long long arrival = test_case->started + interval * worker->id / num_producers; // Staggered across producers.
+
+    self = worker;
+    applySchedule(worker);
+
+    if (!record) {
+        perror("malloc");
+        setWorkerState(worker, WORKER_EXITED, QUEUE_LOCK_NONE);
+        pthread_exit(NULL);
+    }
 
     while (!test_case->terminated)
     {
-        pthread_mutex_lock(&(test_case->producer_lock));
+        Item element = {rand_r(&worker->item_seed) % 201, worker->id, worker->sequence, 0, 0, 0, 0, 0};
+        Queue *queue = &test_case->queue;
 
-        if (size(test_case->front, test_case->rear, test_case->BSIZE) == test_case->BSIZE)
-        {
-            printf("\tQueue is full, cannot produce, waiting for consumer\n");
-            pthread_cond_wait(&(test_case->producer_flag), &(test_case->producer_lock));
+        if (test_case->num_partitions) {
+            element.key = drawKey(test_case, &worker->item_seed);
+            queue = partitionOf(test_case, element.key);
         }
 
-        if (test_case->terminated) {
-            pthread_mutex_unlock(&(test_case->producer_lock));
-            break;
-        }
+        size_t payload_size = test_case->payload_size;
 
-        int element = rand() % 201;
+        if (test_case->payload_min)
+            payload_size = test_case->payload_min + (size_t)rand_r(&worker->item_seed) % (test_case->payload_size - test_case->payload_min + 1);
 
-        if (size(test_case->front, test_case->rear, test_case->BSIZE) == 0)
-        {
-            test_case->front = 0;
-            test_case->rear = 0;
+        element.size = (unsigned int)(sizeof(Item) + payload_size);
+
+        if (payload_size) {
+            unsigned char *payload = record + sizeof(Item);
+            uint32_t seed = payloadSeed(element);
+
+            test_case->kernel->fill(payload, payload_size, seed);
+            element.checksum = payloadChecksum(test_case->kernel, test_case->checksum, payload, payload_size, seed);
+        }
+
+        // A paced producer stamps the time the item was due, so that the latency includes any
+        // time the producer spent blocked on a full buffer (rather than omitting it).
+        if (interval) {
+            setWorkerState(worker, WORKER_SLEEPING, QUEUE_LOCK_NONE);
+            sleepUntil(arrival);
+            setWorkerState(worker, WORKER_RUNNING, QUEUE_LOCK_NONE);
+
+            element.pushed_at = arrival;
+            arrival += worker->id == 0 && test_case->fault == FAULT_BURST && faultActive(test_case, arrival) ? interval / test_case->fault_factor : interval;
+        } else {
+            element.pushed_at = now();
         }
 
-        buf[test_case->rear++] = element;
-        test_case->rear %= test_case->BSIZE;
-        printf("\tProducer produces an item %d\n", element);
+        if (test_case->ttl)
+            element.expires = element.pushed_at + test_case->ttl;
+
+        memcpy(record, &element, sizeof(Item));
+
+        if (!queuePush(queue, record))
+            break;
+
+        worker->sequence++;
 
-        pthread_cond_signal(&(test_case->consumer_flag));
+        if (!test_case->quiet)
+            printf("\tProducer produces an item %d\n", element.value);
 
-        pthread_mutex_unlock(&(test_case->producer_lock));
+        __atomic_store_n(&worker->last_op, now(), __ATOMIC_RELAXED);
+        __atomic_add_fetch(&worker->operations, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&test_case->progress, 1, __ATOMIC_RELAXED);
 
-        sleep(rand() % test_case->producer_sleep_duration);
+        if (interval)
+            continue;
+
+        setWorkerState(worker, WORKER_SLEEPING, QUEUE_LOCK_NONE);
+
+        // A bursting producer sleeps 'fault_factor' times less.
+        if (worker->id == 0 && test_case->fault == FAULT_BURST && faultActive(test_case, now()))
+            sleepUntil(now() + (rand_r(&worker->arrival_seed) % test_case->producer_sleep_duration) * 1000000000LL / test_case->fault_factor);
+        else
+            sleep(rand_r(&worker->arrival_seed) % test_case->producer_sleep_duration);
+
+        setWorkerState(worker, WORKER_RUNNING, QUEUE_LOCK_NONE);
     }
 
+    free(record);
+    setWorkerState(worker, WORKER_EXITED, QUEUE_LOCK_NONE);
+
     pthread_exit(NULL);
 }
 
+/**
+ * Processes an item popped by a consumer thread: verifies its payload (if any) and records
+ * it for verification. A stale item is only recorded.
+ *
+ * @param worker The consumer.
+ * @param record The item, followed by its payload.
+ * @param current_time The CLOCK_MONOTONIC time (in nanoseconds) at which it is processed.
+ *
+ * @return Whether the item was processed, rather than discarded as stale.
+ */
+static bool consumeItem(Worker *worker, const unsigned char *record, long long current_time)
+{
+    TestCase *test_case = worker->test_case;
+    Item element;
+
+    memcpy(&element, record, sizeof(Item));
+
+    if (itemExpired(test_case, &element, current_time)) {
+        recordItem(worker, element);
+        worker->expired++;
+
+        __atomic_store_n(&worker->last_op, current_time, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&test_case->progress, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    if (element.size < sizeof(Item) || element.size > test_case->queue.item_size) {
+        worker->corrupt++;
+    } else if (element.size > sizeof(Item)) {
+        uint32_t checksum = payloadChecksum(test_case->kernel, test_case->checksum, record + sizeof(Item), element.size - sizeof(Item), payloadSeed(element));
+
+        if (checksum != element.checksum)
+            worker->corrupt++;
+    }
+
+    if (!test_case->quiet)
+        printf("\tConsumer consumes an item %d\n", element.value);
+
+    recordItem(worker, element);
+
+    if (element.pushed_at)
+        recordLatency(&worker->latency, current_time - element.pushed_at);
+
+    if (element.pushed_at && test_case->fault)
+        recordLatency(&worker->fault_latency[faultPhase(test_case, element.pushed_at)], current_time - element.pushed_at);
+
+    __atomic_store_n(&worker->last_op, now(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&worker->operations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&test_case->progress, 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
 /**
  * The function used with a consumer thread.
  *
- * Removes the first item in the buffer and
- * locks all other consumer threads while this consumer is consuming,
- * signals to the next producer to start producing, then unlocks the
- * consumer lock so other consumers can produce and sleeps for y seconds.
+ * Removes the first item in the buffer (or, when batching, collects a batch) using the test
+ * case's engine, processes it, then sleeps for y seconds.
  *
- * @param argv The arguments passed to the consumer thread.
+ * @param argv The consumer's worker.
  */
 void *consume(void *argv)
 {
-    TestCase *test_case = (TestCase *)argv;
-    int *buf = test_case->buf;
+    Worker *worker = (Worker *)argv;
+    TestCase *test_case = worker->test_case;
+    size_t item_size = test_case->queue.item_size;
+    unsigned char *record = (unsigned char *)malloc(item_size * (test_case->batch_size > 1 ? test_case->batch_size : 1));
+    Queue *queue = testCaseQueue(test_case, test_case->num_partitions ? worker->id : 0);
+
+    self = worker;
+    applySchedule(worker);
+
+    if (!record) {
+        perror("malloc");
+        setWorkerState(worker, WORKER_EXITED, QUEUE_LOCK_NONE);
+        pthread_exit(NULL);
+    }
 
     while (!test_case->terminated)
     {
-        pthread_mutex_lock(&(test_case->consumer_lock));
+        int count = test_case->batch_size > 1 ? collectBatch(worker, queue, record) : queuePop(queue, record);
 
-        if (size(test_case->front, test_case->rear, test_case->BSIZE) == 0)
-        {
-            printf("\tQueue is empty, cannot consume, waiting for producer\n");
-            pthread_cond_wait(&(test_case->consumer_flag), &(test_case->consumer_lock));
+        if (!count)
+            break;
+
+        // A frozen consumer holds on to what it popped until the fault is over.
+        if (worker->id == 0 && test_case->fault == FAULT_FREEZE && faultActive(test_case, now()))
+            freezeWorker(worker);
+
+        long long current_time = now();
+
+        int served = 0;
+
+        for (int i = 0; i < count; i++)
+            served += consumeItem(worker, record + (size_t)i * item_size, current_time);
+
+        // A batch costs a consumer a single sleep, however many items it holds.
+        if (!served)
+            continue;
+
+        setWorkerState(worker, WORKER_SLEEPING, QUEUE_LOCK_NONE);
+
+        int slowdown = worker->id == 0 && test_case->fault == FAULT_SLOW && faultActive(test_case, current_time) ? test_case->fault_factor : 1;
+
+        // With a service time, every item processed takes its own draw of it instead.
+        if (test_case->service_time) {
+            long long busy = 0;
+
+            for (int i = 0; i < served; i++)
+                busy += drawServiceTime(test_case, &worker->service_seed);
+
+            sleepUntil(now() + busy * slowdown);
+        } else if (slowdown > 1)
+            sleepUntil(now() + (rand_r(&worker->service_seed) % test_case->consumer_sleep_duration) * 1000000000LL * slowdown);
+        else
+            sleep(rand_r(&worker->service_seed) % test_case->consumer_sleep_duration);
+
+        setWorkerState(worker, WORKER_RUNNING, QUEUE_LOCK_NONE);
+    }
+
+    free(record);
+    setWorkerState(worker, WORKER_EXITED, QUEUE_LOCK_NONE);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Adds a sequence number to a bitmap, growing the bitmap as needed.
+ *
+ * @param bitmap The bitmap to add the sequence number to.
+ * @param bit The sequence number to add.
+ *
+ * @return Whether the sequence number was already present in the bitmap.
+ */
+bool setBit(Bitmap *bitmap, unsigned int bit)
+{
+    size_t word = bit / 64;
+
+    if (word >= bitmap->num_words) {
+        size_t num_words = bitmap->num_words ? bitmap->num_words : 1;
+
+        while (num_words <= word)
+            num_words *= 2;
+
+        uint64_t *words = (uint64_t *)realloc(bitmap->words, sizeof(uint64_t) * num_words);
+
+        if (!words) {
+            perror("realloc");
+            return false;
+        }
+
+        memset(words + bitmap->num_words, 0, sizeof(uint64_t) * (num_words - bitmap->num_words));
+        bitmap->words = words;
+        bitmap->num_words = num_words;
+    }
+
+    uint64_t mask = (uint64_t)1 << (bit % 64);
+    bool present = (bitmap->words[word] & mask) != 0;
+
+    bitmap->words[word] |= mask;
+
+    return present;
+}
+
+/**
+ * Records an item consumed by a consumer thread in that consumer's private bitmaps.
+ *
+ * Only the consumer itself touches its bitmaps, so recording an item costs a bit test and
+ * set (plus an occasional reallocation) without any synchronization. Duplicates seen by a
+ * single consumer are counted here; the bitmaps of all consumers are merged by 'verify'.
+ *
+ * @param consumer The consumer that consumed the item.
+ * @param item The consumed item.
+ */
+void recordItem(Worker *consumer, Item item)
+{
+    TestCase *test_case = consumer->test_case;
+
+    if (item.producer_id < 0 || item.producer_id >= test_case->num_producers) {
+        consumer->corrupt++;
+        return;
+    }
+
+    if (setBit(&consumer->seen[item.producer_id], item.sequence))
+        consumer->duplicates++;
+
+    if (test_case->num_keys)
+        recordKey(consumer, item);
+
+    // Items of a single producer must reach any given consumer in the order they were produced.
+    if ((long long)item.sequence < consumer->last_sequence[item.producer_id]) {
+        if (test_case->engine->fifo && !test_case->unordered)
+            consumer->out_of_order++;
+    } else {
+        consumer->last_sequence[item.producer_id] = item.sequence;
+    }
+}
+
+/**
+ * Merges the bitmaps of every consumer (and the items left in the buffer) to verify that
+ * every item produced during the test case was consumed exactly once, then prints the
+ * outcome.
+ *
+ * Must only be called once every producer and consumer thread has been joined.
+ *
+ * @param test_case The finished test case.
+ */
+void verify(TestCase *test_case)
+{
+    int num_producers = test_case->num_producers;
+    unsigned long produced = 0;
+    unsigned long consumed = 0;
+    unsigned long lost = 0;
+    unsigned long duplicates = 0;
+    unsigned long out_of_order = 0;
+    unsigned long corrupt = 0;
+    unsigned long long coalesced = 0;
+    unsigned long long dropped = 0;
+    unsigned long long peak_bytes = 0;
+
+    // The items still in the buffer(s) are accounted for as if consumed by an extra consumer.
+    Bitmap *remaining = (Bitmap *)calloc(num_producers, sizeof(Bitmap));
+    int in_buffer = 0;
+
+    if (!remaining) {
+        perror("calloc");
+        return;
+    }
+
+    for (int q = 0; q < numTestCaseQueues(test_case); q++) {
+        Queue *queue = testCaseQueue(test_case, q);
+        int size = queueSize(queue);
+        QueueStats stats;
+        int pending;
+
+        // A coalescing engine loses exactly one pending item per push it coalesces, and a
+        // dropping engine every item it had no room for.
+        queueStats(queue, &stats, &pending);
+        coalesced += stats.coalesced;
+        dropped += stats.dropped;
+
+        if (stats.peak_bytes > peak_bytes)
+            peak_bytes = stats.peak_bytes;
+
+        // An engine that overran the buffer leaves at most one readable item per slot. The
+        // queue's own slots count, not the row's BSIZE: template mode rounds the capacity up.
+        if (size < 0)
+            size = 0;
+        else if (!queue->engine->byte_budget && (uint64_t)size > queue->mask + 1)
+            size = (int)(queue->mask + 1);
+
+        unsigned char *items = (unsigned char *)malloc(queue->item_size * (size ? size : 1));
+
+        if (!items) {
+            perror("malloc");
+            continue;
+        }
+
+        size = queuePeekBatch(queue, items, size);
+
+        for (int i = 0; i < size; i++) {
+            Item item;
+
+            memcpy(&item, items + (size_t)i * queue->item_size, sizeof(Item));
+
+            if (item.producer_id < 0 || item.producer_id >= num_producers)
+                corrupt++;
+            else if (setBit(&remaining[item.producer_id], item.sequence))
+                duplicates++;
         }
 
-        if (test_case->terminated) {
-            pthread_mutex_unlock(&(test_case->consumer_lock));
+        free(items);
+
+        in_buffer += size;
+    }
+
+    for (int i = num_producers; i < test_case->num_workers; i++) {
+        Worker *consumer = &test_case->workers[i];
+
+        consumed += consumer->operations + consumer->expired;
+        duplicates += consumer->duplicates;
+        out_of_order += consumer->out_of_order;
+        corrupt += consumer->corrupt;
+    }
+
+    // The items removed by the sweeper are accounted for like those of another consumer.
+    if (test_case->sweeper) {
+        consumed += test_case->sweeper->operations;
+        duplicates += test_case->sweeper->duplicates;
+        corrupt += test_case->sweeper->corrupt;
+    }
+
+    for (int producer = 0; producer < num_producers; producer++) {
+        unsigned int sequences = test_case->workers[producer].sequence;
+        size_t num_words = (sequences + 63) / 64;
+        uint64_t *merged = (uint64_t *)calloc(num_words ? num_words : 1, sizeof(uint64_t));
+
+        if (!merged) {
+            perror("calloc");
+            continue;
+        }
+
+        int sources = test_case->num_workers + (test_case->sweeper ? 2 : 1);
+
+        for (int i = num_producers; i < sources; i++) {
+            Bitmap *bitmap = &remaining[producer];
+
+            if (i < test_case->num_workers)
+                bitmap = &test_case->workers[i].seen[producer];
+            else if (i > test_case->num_workers)
+                bitmap = &test_case->sweeper->seen[producer];
+
+            for (size_t word = 0; word < bitmap->num_words; word++) {
+                uint64_t bits = bitmap->words[word];
+
+                // Sequence numbers that were never produced can only come from corrupted items.
+                if (word >= num_words) {
+                    corrupt += __builtin_popcountll(bits);
+                    continue;
+                }
+
+                if (word == num_words - 1 && sequences % 64) {
+                    uint64_t valid = ((uint64_t)1 << (sequences % 64)) - 1;
+
+                    corrupt += __builtin_popcountll(bits & ~valid);
+                    bits &= valid;
+                }
+
+                duplicates += __builtin_popcountll(merged[word] & bits);
+                merged[word] |= bits;
+            }
+        }
+
+        unsigned long accounted = 0;
+
+        for (size_t word = 0; word < num_words; word++)
+            accounted += __builtin_popcountll(merged[word]);
+
+        produced += sequences;
+        lost += sequences - accounted;
+
+        free(merged);
+        free(remaining[producer].words);
+    }
+
+    free(remaining);
+
+    bool passed = lost == coalesced + dropped && !duplicates && !out_of_order && !corrupt;
+    TestCaseResult *result = &test_case->result;
+
+    result->verified = true;
+    result->passed = passed;
+    result->produced = produced;
+    result->consumed = consumed;
+    result->lost = lost;
+    result->duplicates = duplicates;
+    result->out_of_order = out_of_order;
+    result->corrupt = corrupt;
+    result->throughput = consumed / ((now() - test_case->started) / 1e9);
+
+    printf("\tVerification: produced = %lu, consumed = %lu, in buffer = %d, lost = %lu (coalesced = %llu, dropped = %llu), duplicated = %lu, out of order = %lu%s, corrupt = %lu (%s)\n",
+           produced, consumed, in_buffer, lost, coalesced, dropped, duplicates, out_of_order, test_case->engine->fifo && !test_case->unordered ? "" : " (not checked)", corrupt, passed ? "PASS" : "FAIL");
+
+    if (test_case->engine->coalescing && produced)
+        printf("\tCoalescing: %llu of %lu items replaced a pending item of their key (ratio %.1f%%), so consumers handled %lu items instead of %lu\n",
+               coalesced, produced, 100.0 * coalesced / produced, consumed, consumed + (unsigned long)coalesced);
+
+    if (test_case->engine->byte_budget) {
+        size_t budget = test_case->queue.byte_budget;
+
+        printf("\tMemory: budget = %zu bytes, high-water mark = %llu bytes (%.1f%% of the budget)%s, dropped = %llu (%.1f%% of the items)\n", budget, peak_bytes, 100.0 * peak_bytes / budget,
+               test_case->num_partitions ? " per partition" : "", dropped, produced ? 100.0 * dropped / produced : 0);
+    }
+}
+
+/**
+ * Prints the state of every producer and consumer thread of a test case together with
+ * the buffer's indices.
+ *
+ * The buffer's indices are read without taking either lock, so they are only a best
+ * effort snapshot.
+ *
+ * @param test_case The stalled test case.
+ */
+void dumpThreadStates(TestCase *test_case)
+{
+    static const char *states[] = {
+        "running",
+        "acquiring",
+        "waiting on full",
+        "waiting on empty",
+        "sleeping",
+        "exited"
+    };
+    static const char *locks[] = {"none", "producer_lock", "consumer_lock"};
+
+    long long current_time = now();
+    long long last_progress = 0;
+
+    for (int i = 0; i < test_case->num_workers; i++) {
+        long long last_op = __atomic_load_n(&test_case->workers[i].last_op, __ATOMIC_RELAXED);
+
+        if (last_op > last_progress)
+            last_progress = last_op;
+    }
+
+    if (!last_progress)
+        last_progress = test_case->started;
+
+    printf("\tWatchdog: no progress for %lld ms (terminated = %s)\n", (current_time - last_progress) / 1000000, test_case->terminated ? "true" : "false");
+    for (int q = 0; q < numTestCaseQueues(test_case); q++) {
+        Queue *queue = testCaseQueue(test_case, q);
+        uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+        printf("\t\t%s %d: head = %llu, tail = %llu, size = %lld, BSIZE = %d\n", test_case->num_partitions ? "partition" : "buffer", q, (unsigned long long)head, (unsigned long long)tail, (long long)(tail - head), test_case->BSIZE);
+    }
+
+    for (int i = 0; i < test_case->num_workers; i++) {
+        Worker *worker = &test_case->workers[i];
+        WorkerState state = __atomic_load_n(&worker->state, __ATOMIC_RELAXED);
+        QueueLock lock = __atomic_load_n(&worker->lock, __ATOMIC_RELAXED);
+        long long last_op = __atomic_load_n(&worker->last_op, __ATOMIC_RELAXED);
+
+        printf("\t\t%s %d: %s, %s %s, ", worker->is_producer ? "producer" : "consumer", worker->id, states[state], state == WORKER_ACQUIRING ? "acquiring" : "holding", locks[lock]);
+
+        if (last_op)
+            printf("last op %lld ms ago", (current_time - last_op) / 1000000);
+        else
+            printf("no ops yet");
+
+        printf(", ops = %lu\n", __atomic_load_n(&worker->operations, __ATOMIC_RELAXED));
+    }
+
+    fflush(stdout);
+}
+
+/**
+ * The function used with the watchdog thread.
+ *
+ * Samples the test case's progress counter every 'watchdog_interval' seconds until every
+ * producer and consumer has been joined. When no item was produced or consumed during an
+ * interval, no thread is merely sleeping and not every thread has exited yet, the test
+ * case is considered stalled: the state of every thread is dumped and, when
+ * 'watchdog_abort' is set, the test case is terminated and all waiting threads are woken
+ * up (repeatedly, as the broken wake-ups are what usually wedge it).
+ *
+ * @param argv The test case to watch.
+ */
+void *watch(void *argv)
+{
+    TestCase *test_case = (TestCase *)argv;
+    unsigned long last_progress = 0;
+
+    pthread_mutex_lock(&(test_case->done_lock));
+
+    while (!test_case->finished)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += test_case->watchdog_interval;
+
+        while (!test_case->finished && pthread_cond_timedwait(&(test_case->done_flag), &(test_case->done_lock), &deadline) != ETIMEDOUT);
+
+        if (test_case->finished)
             break;
+
+        unsigned long progress = __atomic_load_n(&test_case->progress, __ATOMIC_RELAXED);
+
+        if (progress != last_progress) {
+            last_progress = progress;
+            continue;
+        }
+
+        bool sleeping = false;
+        int exited = 0;
+
+        for (int i = 0; i < test_case->num_workers; i++) {
+            WorkerState state = __atomic_load_n(&test_case->workers[i].state, __ATOMIC_RELAXED);
+
+            sleeping |= state == WORKER_SLEEPING;
+            exited += state == WORKER_EXITED;
         }
 
-        int element = buf[test_case->front++];
-        test_case->front %= test_case->BSIZE;
-        printf("\tConsumer consumes an item %d\n", element);
+        if (sleeping || exited == test_case->num_workers)
+            continue;
 
-        if (test_case->front == test_case->rear)
-            test_case->front = -1;
+        dumpThreadStates(test_case);
 
-        pthread_cond_signal(&(test_case->producer_flag));
+        if (test_case->watchdog_abort) {
+            printf("\tWatchdog: aborting test case\n");
+            test_case->terminated = true;
+            pthread_cond_broadcast(&(test_case->done_flag));
 
-        pthread_mutex_unlock(&(test_case->consumer_lock));
+            pthread_mutex_unlock(&(test_case->done_lock));
 
-        sleep(rand() % test_case->consumer_sleep_duration);
+            for (int q = 0; q < numTestCaseQueues(test_case); q++)
+                queueClose(testCaseQueue(test_case, q));
+
+            pthread_mutex_lock(&(test_case->done_lock));
+        }
     }
 
+    pthread_mutex_unlock(&(test_case->done_lock));
+
     pthread_exit(NULL);
 }
 
+/**
+ * Allocates a test case's producer and consumer workers (producers first) and starts its
+ * clock.
+ *
+ * @param test_case The test case.
+ * @param num_producers The number of producers.
+ * @param num_consumers The number of consumers.
+ *
+ * @return Whether the workers could be allocated.
+ */
+bool initWorkers(TestCase *test_case, int num_producers, int num_consumers)
+{
+    test_case->progress = 0;
+    test_case->started = now();
+    test_case->num_workers = num_producers + num_consumers;
+    test_case->workers = (Worker *)calloc(test_case->num_workers, sizeof(Worker));
+
+    if (!test_case->workers) {
+        perror("calloc");
+        return false;
+    }
+
+    test_case->num_producers = num_producers;
+
+    for (int i = 0; i < test_case->num_workers; i++) {
+        Worker *worker = &test_case->workers[i];
+
+        worker->test_case = test_case;
+        worker->is_producer = i < num_producers;
+        worker->id = i < num_producers ? i : i - num_producers;
+        worker->arrival_seed = deriveSeed(test_case->seed, worker, RANDOM_ARRIVALS);
+        worker->item_seed = deriveSeed(test_case->seed, worker, RANDOM_ITEMS);
+        worker->service_seed = deriveSeed(test_case->seed, worker, RANDOM_SERVICE);
+
+        if (!worker->is_producer) {
+            worker->seen = (Bitmap *)calloc(num_producers, sizeof(Bitmap));
+            worker->last_sequence = (long long *)malloc(sizeof(long long) * num_producers);
+
+            if (!worker->seen || !worker->last_sequence) {
+                perror("malloc");
+                exit(1);
+            }
+
+            for (int producer = 0; producer < num_producers; producer++)
+                worker->last_sequence[producer] = -1;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Releases a test case's workers (and their bitmaps).
+ *
+ * @param test_case The test case.
+ */
+void freeWorkers(TestCase *test_case)
+{
+    for (int i = test_case->num_producers; i < test_case->num_workers; i++) {
+        for (int producer = 0; producer < test_case->num_producers; producer++)
+            free(test_case->workers[i].seen[producer].words);
+
+        free(test_case->workers[i].seen);
+        free(test_case->workers[i].last_sequence);
+    }
+
+    free(test_case->workers);
+    test_case->workers = NULL;
+}
+
 /**
  * Executes the simulation of the producer and consumer problem based on a given test case.
  *
@@ -313,67 +1101,322 @@ void *consume(void *argv)
 void execute(int test_case_number, int test_case_duration, int num_producers, int num_consumers, TestCase *test_case)
 {
     printf("Test Case %d\n", test_case_number);
-    printf("\tbufferSize = %d, producer_sleep_duration = %d, consumer_sleep_duration = %d, num_producers = %d, num_consumers = %d \n", test_case->BSIZE, test_case->producer_sleep_duration, test_case->consumer_sleep_duration, num_producers, num_consumers);
+    printf("\tbufferSize = %d, producer_sleep_duration = %d, consumer_sleep_duration = %d, num_producers = %d, num_consumers = %d, engine = %s, slot_align = %zu, prefetch = %d \n", test_case->BSIZE, test_case->producer_sleep_duration, test_case->consumer_sleep_duration, num_producers, num_consumers, test_case->engine->name, test_case->layout.slot_align, test_case->layout.prefetch);
+
+    if (test_case->payload_size) {
+        if (test_case->payload_min)
+            printf("\tpayload = %zu-%zu bytes, checksum = %s, kernel = %s \n", test_case->payload_min, test_case->payload_size, payloadChecksumName(test_case->checksum), test_case->kernel->name);
+        else
+            printf("\tpayload = %zu bytes, checksum = %s, kernel = %s \n", test_case->payload_size, payloadChecksumName(test_case->checksum), test_case->kernel->name);
+    }
+
+    if (test_case->engine->byte_budget)
+        printf("\tbudget = %zu bytes \n", test_case->layout.byte_budget ? test_case->layout.byte_budget : test_case->BSIZE * (QUEUE_RECORD_HEADER + sizeof(Item) + test_case->payload_size));
+
+    if (test_case->num_keys)
+        printf("\tkeys = %d, zipf = %.2f, partitions = %d \n", test_case->num_keys, test_case->zipf, num_consumers);
+
+    if (test_case->ttl)
+        printf("\tttl = %lld ms, sweep = %d ms \n", test_case->ttl / 1000000, test_case->sweep_interval);
+
+    if (test_case->batch_size > 1)
+        printf("\tbatch = %d, linger = %d us \n", test_case->batch_size, test_case->linger);
 
-    pthread_mutex_init(&(test_case->producer_lock), NULL);
-    pthread_mutex_init(&(test_case->consumer_lock), NULL);
-    pthread_cond_init(&(test_case->producer_flag), NULL);
-    pthread_cond_init(&(test_case->consumer_flag), NULL);
+    if (test_case->rate > 0 || test_case->service_time)
+        printf("\trate = %.1f items/s, service = %lld us (%s) \n", test_case->rate, test_case->service_time / 1000, serviceDistributionName(test_case->service_distribution));
+
+    if (scheduleSet(&test_case->producer_schedule) || scheduleSet(&test_case->consumer_schedule))
+        printf("\tproducer_sched = %s, producer_priority = %d, producer_nice = %d, consumer_sched = %s, consumer_priority = %d, consumer_nice = %d \n",
+               schedulePolicyName(test_case->producer_schedule.policy), test_case->producer_schedule.priority, test_case->producer_schedule.nice,
+               schedulePolicyName(test_case->consumer_schedule.policy), test_case->consumer_schedule.priority, test_case->consumer_schedule.nice);
+
+    if (test_case->fault)
+        printf("\tfault = %s, fault_at = %lld ms, fault_for = %lld ms, fault_factor = %d \n", faultName(test_case->fault), test_case->fault_at / 1000000,
+               test_case->fault_for / 1000000, test_case->fault_factor);
+
+    // The buffer is still initialized when keyed: it sets the item size and 'verify' reads its engine.
+    if (!queueInit(&test_case->queue, test_case->engine, test_case->BSIZE, sizeof(Item) + test_case->payload_size, &test_case->layout))
+        return;
+
+    if (test_case->num_keys && !initPartitions(test_case, num_producers, num_consumers, test_case->queue.item_size)) {
+        queueDestroy(&test_case->queue);
+        return;
+    }
+
+    test_case->queue.observer = observe;
+
+    pthread_condattr_t done_flag_attr;
+    pthread_condattr_init(&done_flag_attr);
+    pthread_condattr_setclock(&done_flag_attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&(test_case->done_lock), NULL);
+    pthread_cond_init(&(test_case->done_flag), &done_flag_attr);
+    pthread_condattr_destroy(&done_flag_attr);
+
+    test_case->finished = false;
+
+    if (!initWorkers(test_case, num_producers, num_consumers)) {
+        destroyPartitions(test_case);
+        queueDestroy(&test_case->queue);
+        return;
+    }
+
+    if (test_case->sweep_interval > 0 && !initSweeper(test_case)) {
+        freeWorkers(test_case);
+        destroyPartitions(test_case);
+        queueDestroy(&test_case->queue);
+        return;
+    }
 
+    if (test_case->fault && !initFault(test_case, test_case_duration)) {
+        freeSweeper(test_case);
+        freeWorkers(test_case);
+        destroyPartitions(test_case);
+        queueDestroy(&test_case->queue);
+        return;
+    }
+
+    pthread_t watchdog;
+    pthread_t sweeper;
+    pthread_t sampler;
     pthread_t producers[num_producers];
     pthread_t consumers[num_consumers];
 
-    for (int i = 0; i < num_producers; i++)
-        pthread_create(&producers[i], NULL, produce, (void *)test_case);
+    if (test_case->watchdog_interval > 0)
+        pthread_create(&watchdog, NULL, watch, (void *)test_case);
 
-    for (int i = 0; i < num_consumers; i++)
-        pthread_create(&consumers[i], NULL, consume, (void *)test_case);
+    if (test_case->sweeper)
+        pthread_create(&sweeper, NULL, sweep, (void *)test_case);
 
-    sleep(test_case_duration);
-    test_case->terminated = true;
+    if (test_case->fault)
+        pthread_create(&sampler, NULL, sampleDepth, (void *)test_case);
+
+    pthread_attr_t attr;
+    int spawned_producers = 0;
+    int spawned_consumers = 0;
+
+    initThreadAttributes(test_case, &attr);
+    beginSpawn(test_case);
+
+    while (spawned_producers < num_producers && pthread_create(&producers[spawned_producers], &attr, produce, (void *)&test_case->workers[spawned_producers]) == 0)
+        spawned_producers++;
+
+    while (spawned_producers == num_producers && spawned_consumers < num_consumers &&
+           pthread_create(&consumers[spawned_consumers], &attr, consume, (void *)&test_case->workers[num_producers + spawned_consumers]) == 0)
+        spawned_consumers++;
+
+    endSpawn(test_case, &attr, spawned_producers + spawned_consumers, num_producers + num_consumers - spawned_producers - spawned_consumers);
+    pthread_attr_destroy(&attr);
+
+    // Without all of its threads the test case is meaningless; the ones created are stopped.
+    if (test_case->spawn.failed) {
+        perror("pthread_create");
+
+        pthread_mutex_lock(&(test_case->done_lock));
+        test_case->terminated = true;
+        pthread_mutex_unlock(&(test_case->done_lock));
+    }
+
+    watchTestCase(test_case);
 
-    for (int i = 0; i < num_producers; i++)
-        pthread_cond_signal(&(test_case->producer_flag));
+    // Wait out the test case, unless the watchdog or SIGINT aborts it early.
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += test_case_duration;
 
-    for (int i = 0; i < num_consumers; i++)
-        pthread_cond_signal(&(test_case->consumer_flag));
+    pthread_mutex_lock(&(test_case->done_lock));
+    while (!test_case->terminated && pthread_cond_timedwait(&(test_case->done_flag), &(test_case->done_lock), &deadline) != ETIMEDOUT);
+    test_case->terminated = true;
+    pthread_cond_broadcast(&(test_case->done_flag));
+    pthread_mutex_unlock(&(test_case->done_lock));
+
+    for (int q = 0; q < numTestCaseQueues(test_case); q++)
+        queueClose(testCaseQueue(test_case, q));
 
-    for (int i = 0; i < num_producers; i++)
+    for (int i = 0; i < spawned_producers; i++)
         pthread_join(producers[i], NULL);
 
-    for (int i = 0; i < num_consumers; i++)
+    for (int i = 0; i < spawned_consumers; i++)
         pthread_join(consumers[i], NULL);
 
-    pthread_mutex_destroy(&(test_case->producer_lock));
-    pthread_mutex_destroy(&(test_case->consumer_lock));
+    if (test_case->sweeper)
+        pthread_join(sweeper, NULL);
+
+    if (test_case->fault)
+        pthread_join(sampler, NULL);
+
+    watchTestCase(NULL);
+
+    if (test_case->watchdog_interval > 0) {
+        pthread_mutex_lock(&(test_case->done_lock));
+        test_case->finished = true;
+        pthread_cond_broadcast(&(test_case->done_flag));
+        pthread_mutex_unlock(&(test_case->done_lock));
+
+        pthread_join(watchdog, NULL);
+    }
+
+    verify(test_case);
+    reportThreads(test_case);
+
+    if (test_case->num_partitions)
+        reportPartitions(test_case);
+
+    if (test_case->ttl)
+        reportExpiry(test_case);
+
+    if (test_case->batch_size > 1)
+        reportBatches(test_case);
+
+    reportLatency(test_case);
+
+    if (test_case->fault)
+        reportFault(test_case);
+
+    freeFault(test_case);
+    freeSweeper(test_case);
+    freeWorkers(test_case);
+
+    destroyPartitions(test_case);
+    queueDestroy(&test_case->queue);
+    pthread_mutex_destroy(&(test_case->done_lock));
+    pthread_cond_destroy(&(test_case->done_flag));
 }
 
 int main(int argc, char **argv)
 {
-    srand(time(0));
-
     char *PATH_TO_CONFIG_FILE;
     int MAX_TEST_CASE_DURATION = 0;
+    int WATCHDOG_INTERVAL = 0;
+    bool WATCHDOG_ABORT = false;
+    int STRESS_ROUNDS = 0;
+    int STRESS_OPERATIONS = 200;
+    char *TEMPLATE_WAIT = NULL;
+    char *QUEUES = NULL;
+    double SLO = 0;
+    int SLO_REPEATS = 3;
+    double PLAN = 0;
+    int PLAN_MAX_CONSUMERS = 32;
+    bool ISOLATE = false;
+    int ISOLATE_TIMEOUT = 0;
+    const char *KERNEL = "auto";
+    const char *CLOCK = "auto";
+    unsigned long long SEED = (unsigned long long)time(0);
 
     if (argc < 3)
     {
-        fputs("Incorrect number of arguments.\n\nProducerConsumerTests\nUsage: ./ProducerConsumerTests <PATH_TO_CONFIG_FILE> <MAX_TEST_CASE_DURATION>\n", stderr);
+        fputs("Incorrect number of arguments.\n\n" USAGE, stderr);
         exit(1);
     }
 
     PATH_TO_CONFIG_FILE = argv[1];
     MAX_TEST_CASE_DURATION = atoi(argv[2]);
 
+    for (int i = 3; i < argc; i++) {
+        if (strncmp(argv[i], "--watchdog=", 11) == 0) {
+            WATCHDOG_INTERVAL = atoi(argv[i] + 11);
+        } else if (strcmp(argv[i], "--watchdog-abort") == 0) {
+            WATCHDOG_ABORT = true;
+        } else if (strncmp(argv[i], "--stress=", 9) == 0) {
+            STRESS_ROUNDS = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--stress-ops=", 13) == 0) {
+            STRESS_OPERATIONS = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--template=", 11) == 0) {
+            TEMPLATE_WAIT = argv[i] + 11;
+        } else if (strncmp(argv[i], "--queues=", 9) == 0) {
+            QUEUES = argv[i] + 9;
+        } else if (strncmp(argv[i], "--slo=", 6) == 0) {
+            SLO = atof(argv[i] + 6);
+        } else if (strncmp(argv[i], "--slo-repeats=", 14) == 0) {
+            SLO_REPEATS = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--plan=", 7) == 0) {
+            PLAN = atof(argv[i] + 7);
+        } else if (strncmp(argv[i], "--plan-max-consumers=", 21) == 0) {
+            PLAN_MAX_CONSUMERS = atoi(argv[i] + 21);
+        } else if (strcmp(argv[i], "--isolate") == 0) {
+            ISOLATE = true;
+        } else if (strncmp(argv[i], "--isolate=", 10) == 0) {
+            ISOLATE = true;
+            ISOLATE_TIMEOUT = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--kernel=", 9) == 0) {
+            KERNEL = argv[i] + 9;
+        } else if (strncmp(argv[i], "--clock=", 8) == 0) {
+            CLOCK = argv[i] + 8;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            char *end;
+
+            errno = 0;
+            SEED = strtoull(argv[i] + 7, &end, 0);
+
+            if (errno || end == argv[i] + 7 || *end) {
+                fprintf(stderr, "Invalid seed '%s'.\n\n" USAGE, argv[i] + 7);
+                exit(1);
+            }
+        } else {
+            fprintf(stderr, "Unknown option '%s'.\n\n" USAGE, argv[i]);
+            exit(1);
+        }
+    }
+
+    if ((QUEUES != NULL) + (TEMPLATE_WAIT != NULL) + (STRESS_ROUNDS > 0) + (SLO > 0) + (PLAN > 0) > 1) {
+        fputs("Only one of --queues, --stress, --template, --slo and --plan can be used at a time.\n\n" USAGE, stderr);
+        exit(1);
+    }
+
+    if (!initClock(CLOCK)) {
+        fprintf(stderr, "Unknown clock '%s'.\n\n" USAGE, CLOCK);
+        exit(1);
+    }
+
+    reportClock();
+
+    // Every worker derives its random number streams from the seed; what still draws from
+    // 'rand' (the stress harness's perturbations) is seeded with it as well.
+    srand((unsigned int)SEED);
+    printf("Seed: %llu\n", SEED);
+
+    if (!startSignalThread())
+        exit(1);
+
+    if (WATCHDOG_ABORT && WATCHDOG_INTERVAL <= 0)
+        WATCHDOG_INTERVAL = 5;
+
+    const PayloadKernel *kernel = findPayloadKernel(KERNEL);
+
+    if (!kernel) {
+        fprintf(stderr, "Unknown or unsupported payload kernel '%s'.\n\n" USAGE, KERNEL);
+        exit(1);
+    }
+
     int number_of_lines = numberOfLinesInFile(PATH_TO_CONFIG_FILE);
     char **lines = readFile(PATH_TO_CONFIG_FILE, number_of_lines);
+    TestCaseResult *results = (TestCaseResult *)calloc(number_of_lines ? number_of_lines : 1, sizeof(TestCaseResult));
+    bool *ran = (bool *)calloc(number_of_lines ? number_of_lines : 1, sizeof(bool));
+
+    if (!results || !ran) {
+        perror("calloc");
+        exit(1);
+    }
+
+    if (ISOLATE && ISOLATE_TIMEOUT <= 0) {
+        int runs = 1;
+
+        for (char *c = QUEUES; c && *c; c++)
+            runs += *c == ',';
+
+        // A capacity search runs every probe several times; it rarely takes 40 probes.
+        if (SLO > 0 || PLAN > 0)
+            runs = 40 * (SLO_REPEATS > 0 ? SLO_REPEATS : 1);
+
+        ISOLATE_TIMEOUT = runs * (2 * MAX_TEST_CASE_DURATION + 10);
+    }
 
     for (int test_case_number = 0; test_case_number < number_of_lines; test_case_number++) {
         char **data = split(lines[test_case_number], ',');
 
-        TestCase *test_case = (TestCase *)malloc(sizeof(TestCase));
+        TestCase *test_case = (TestCase *)calloc(1, sizeof(TestCase));
 
         if (!test_case) {
-            perror("malloc");
+            perror("calloc");
             continue;
         }
 
@@ -381,28 +1424,374 @@ int main(int argc, char **argv)
         test_case->producer_sleep_duration = atoi(data[1]);
         test_case->consumer_sleep_duration = atoi(data[2]);
         test_case->terminated = false;
+        test_case->watchdog_interval = WATCHDOG_INTERVAL;
+        test_case->watchdog_abort = WATCHDOG_ABORT;
+        test_case->engine = engineAt(0);
+        test_case->kernel = kernel;
+        test_case->zipf = 1.0;
+        test_case->guard_size = -1;
+        test_case->seed = SEED;
+        test_case->fault_at = 1000000000LL;
+        test_case->fault_for = 1000000000LL;
+        test_case->fault_factor = 100;
+        test_case->layout.key_offset = offsetof(Item, key);
+        test_case->layout.expiry_offset = offsetof(Item, expires);
+        test_case->layout.size_offset = offsetof(Item, size);
+
+        // Any columns after the first five are optional '<KEY>=<VALUE>' settings.
+        bool valid = true;
+
+        for (int i = 5; data[i]; i++) {
+            char *option = trim(data[i]);
+
+            if (strncmp(option, "engine=", 7) == 0) {
+                test_case->engine = findEngine(option + 7);
+
+                if (!test_case->engine) {
+                    fprintf(stderr, "Test Case %d: unknown engine '%s'.\n", test_case_number + 1, option + 7);
+                    valid = false;
+                }
+            } else if (strncmp(option, "slot_align=", 11) == 0) {
+                int align = atoi(option + 11);
+
+                if (align < 0 || (align & (align - 1)) != 0) {
+                    fprintf(stderr, "Test Case %d: slot_align must be 0 or a power of two.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->layout.slot_align = align > 0 ? (size_t)align : 0;
+            } else if (strncmp(option, "prefetch=", 9) == 0) {
+                test_case->layout.prefetch = atoi(option + 9);
+
+                if (test_case->layout.prefetch < 0) {
+                    fprintf(stderr, "Test Case %d: prefetch must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+            } else if (strncmp(option, "payload=", 8) == 0) {
+                int size = atoi(option + 8);
+
+                if (size < 0) {
+                    fprintf(stderr, "Test Case %d: payload must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->payload_size = size > 0 ? (size_t)size : 0;
+            } else if (strncmp(option, "payload_min=", 12) == 0) {
+                int size = atoi(option + 12);
+
+                if (size < 0) {
+                    fprintf(stderr, "Test Case %d: payload_min must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->payload_min = size > 0 ? (size_t)size : 0;
+            } else if (strncmp(option, "budget=", 7) == 0) {
+                long budget = atol(option + 7);
+
+                if (budget <= 0) {
+                    fprintf(stderr, "Test Case %d: budget must be positive.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->layout.byte_budget = budget > 0 ? (size_t)budget : 0;
+            } else if (strncmp(option, "checksum=", 9) == 0) {
+                if (!findPayloadChecksum(option + 9, &test_case->checksum)) {
+                    fprintf(stderr, "Test Case %d: unknown checksum '%s'.\n", test_case_number + 1, option + 9);
+                    valid = false;
+                }
+            } else if (strncmp(option, "keys=", 5) == 0) {
+                test_case->num_keys = atoi(option + 5);
+
+                if (test_case->num_keys < 0) {
+                    fprintf(stderr, "Test Case %d: keys must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+            } else if (strncmp(option, "zipf=", 5) == 0) {
+                test_case->zipf = atof(option + 5);
+
+                if (test_case->zipf < 0) {
+                    fprintf(stderr, "Test Case %d: zipf must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+            } else if (strncmp(option, "ttl=", 4) == 0) {
+                int ttl = atoi(option + 4);
+
+                if (ttl < 0) {
+                    fprintf(stderr, "Test Case %d: ttl must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->ttl = ttl > 0 ? ttl * 1000000LL : 0;
+            } else if (strncmp(option, "sweep=", 6) == 0) {
+                test_case->sweep_interval = atoi(option + 6);
+
+                if (test_case->sweep_interval < 0) {
+                    fprintf(stderr, "Test Case %d: sweep must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+            } else if (strncmp(option, "batch=", 6) == 0) {
+                test_case->batch_size = atoi(option + 6);
+
+                if (test_case->batch_size < 1) {
+                    fprintf(stderr, "Test Case %d: batch must be positive.\n", test_case_number + 1);
+                    valid = false;
+                }
+            } else if (strncmp(option, "linger=", 7) == 0) {
+                test_case->linger = atoi(option + 7);
+
+                if (test_case->linger < 0) {
+                    fprintf(stderr, "Test Case %d: linger must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+            } else if (strncmp(option, "rate=", 5) == 0) {
+                test_case->rate = atof(option + 5);
+
+                if (test_case->rate < 0) {
+                    fprintf(stderr, "Test Case %d: rate must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+            } else if (strncmp(option, "service=", 8) == 0) {
+                long service = atol(option + 8);
+
+                if (service < 0) {
+                    fprintf(stderr, "Test Case %d: service must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->service_time = service > 0 ? service * 1000LL : 0;
+            } else if (strncmp(option, "service_dist=", 13) == 0) {
+                const char *name = option + 13;
+
+                if (strcmp(name, "fixed") == 0) {
+                    test_case->service_distribution = SERVICE_FIXED;
+                } else if (strcmp(name, "exp") == 0) {
+                    test_case->service_distribution = SERVICE_EXPONENTIAL;
+                } else if (strcmp(name, "uniform") == 0) {
+                    test_case->service_distribution = SERVICE_UNIFORM;
+                } else {
+                    fprintf(stderr, "Test Case %d: unknown service_dist '%s'.\n", test_case_number + 1, name);
+                    valid = false;
+                }
+            } else if (strncmp(option, "stack=", 6) == 0) {
+                long stack = atol(option + 6);
+
+                if (stack <= 0) {
+                    fprintf(stderr, "Test Case %d: stack must be positive.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->stack_size = stack > 0 ? (size_t)stack * 1024 : 0;
+            } else if (strncmp(option, "guard=", 6) == 0) {
+                long guard = atol(option + 6);
+
+                if (guard < 0) {
+                    fprintf(stderr, "Test Case %d: guard must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->guard_size = guard >= 0 ? guard * 1024 : -1;
+            } else if (strncmp(option, "fault=", 6) == 0) {
+                const char *name = option + 6;
+
+                if (strcmp(name, "none") == 0) {
+                    test_case->fault = FAULT_NONE;
+                } else if (strcmp(name, "freeze") == 0) {
+                    test_case->fault = FAULT_FREEZE;
+                } else if (strcmp(name, "burst") == 0) {
+                    test_case->fault = FAULT_BURST;
+                } else if (strcmp(name, "slow") == 0) {
+                    test_case->fault = FAULT_SLOW;
+                } else {
+                    fprintf(stderr, "Test Case %d: unknown fault '%s'.\n", test_case_number + 1, name);
+                    valid = false;
+                }
+            } else if (strncmp(option, "fault_at=", 9) == 0) {
+                long at = atol(option + 9);
+
+                if (at < 0) {
+                    fprintf(stderr, "Test Case %d: fault_at must not be negative.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->fault_at = at * 1000000LL;
+            } else if (strncmp(option, "fault_for=", 10) == 0) {
+                long length = atol(option + 10);
+
+                if (length <= 0) {
+                    fprintf(stderr, "Test Case %d: fault_for must be positive.\n", test_case_number + 1);
+                    valid = false;
+                }
+
+                test_case->fault_for = length * 1000000LL;
+            } else if (strncmp(option, "fault_factor=", 13) == 0) {
+                test_case->fault_factor = atoi(option + 13);
+
+                if (test_case->fault_factor < 1) {
+                    fprintf(stderr, "Test Case %d: fault_factor must be at least 1.\n", test_case_number + 1);
+                    valid = false;
+                }
+            } else if (strncmp(option, "producer_", 9) == 0 || strncmp(option, "consumer_", 9) == 0) {
+                ThreadSchedule *schedule = option[0] == 'p' ? &test_case->producer_schedule : &test_case->consumer_schedule;
+                const char *setting = option + 9;
+
+                if (strncmp(setting, "sched=", 6) == 0) {
+                    if (!parseSchedulePolicy(setting + 6, &schedule->policy)) {
+                        fprintf(stderr, "Test Case %d: unknown scheduling policy '%s'.\n", test_case_number + 1, setting + 6);
+                        valid = false;
+                    }
+                } else if (strncmp(setting, "priority=", 9) == 0) {
+                    schedule->priority = atoi(setting + 9);
+                } else if (strncmp(setting, "nice=", 5) == 0) {
+                    schedule->nice = atoi(setting + 5);
+                } else {
+                    fprintf(stderr, "Test Case %d: unknown option '%s'.\n", test_case_number + 1, option);
+                    valid = false;
+                }
+            } else if (*option) {
+                fprintf(stderr, "Test Case %d: unknown option '%s'.\n", test_case_number + 1, option);
+                valid = false;
+            }
+        }
+
+        if (valid && test_case->payload_min > test_case->payload_size) {
+            fprintf(stderr, "Test Case %d: payload_min must not exceed payload.\n", test_case_number + 1);
+            valid = false;
+        }
+
+        const char *producer_schedule_error = checkSchedule(&test_case->producer_schedule);
+        const char *consumer_schedule_error = checkSchedule(&test_case->consumer_schedule);
+
+        if (valid && (producer_schedule_error || consumer_schedule_error)) {
+            fprintf(stderr, "Test Case %d: %s scheduling: %s.\n", test_case_number + 1, producer_schedule_error ? "producer" : "consumer",
+                    producer_schedule_error ? producer_schedule_error : consumer_schedule_error);
+            valid = false;
+        }
+
+        // The sweeper pops beside the consumers, which the single consumer engines do not allow.
+        if (valid && test_case->sweep_interval > 0 && (!test_case->ttl || !test_case->engine->sweep)) {
+            fprintf(stderr, "Test Case %d: sweep needs a ttl and an engine that can sweep (engine '%s').\n", test_case_number + 1, test_case->engine->name);
+            valid = false;
+        }
 
-        test_case->buf = (int *)malloc(sizeof(int) * test_case->BSIZE);
-        test_case->front = -1;
-        test_case->rear = -1;
+        if (!valid) {
+            free(test_case);
+            free(data);
+            continue;
+        }
 
         int num_producers = atoi(data[3]);
         int num_consumers = atoi(data[4]);
 
-        execute(
-                test_case_number + 1,
-                MAX_TEST_CASE_DURATION,
-                num_producers,
-                num_consumers,
-                test_case);
+        // A keyed test case gives every consumer a partition of its own, and a queue pool
+        // has every buffer popped by a single consumer.
+        if ((test_case->engine->single_producer && num_producers > 1) || (test_case->engine->single_consumer && num_consumers > 1 && !test_case->num_keys && !QUEUES)) {
+            fprintf(stderr, "Test Case %d: engine '%s' supports a single %s.\n", test_case_number + 1, test_case->engine->name,
+                    test_case->engine->single_producer && num_producers > 1 ? "producer" : "consumer");
+            free(test_case);
+            free(data);
+            continue;
+        }
+
+        // An isolated test case runs in a child process, which sends its result back and exits.
+        pid_t child = 0;
+        int channel = -1;
+
+        ran[test_case_number] = true;
+
+        if (ISOLATE)
+            child = forkTestCase(&channel);
+
+        if (child > 0) {
+            watchChild(child);
+            awaitTestCase(test_case_number + 1, child, channel, ISOLATE_TIMEOUT, &results[test_case_number]);
+            watchChild(0);
+        } else if (QUEUES) {
+            char *list = strdup(QUEUES);
+            char **counts = list ? split(list, ',') : NULL;
+
+            for (int k = 0; counts && counts[k]; k++) {
+                // Every size runs on a fresh copy of the parsed test case.
+                TestCase pool = *test_case;
+
+                serveQueues(
+                        test_case_number + 1,
+                        MAX_TEST_CASE_DURATION,
+                        num_producers,
+                        num_consumers,
+                        atoi(counts[k]),
+                        &pool);
+
+                test_case->result = pool.result;
+            }
+
+            free(counts);
+            free(list);
+        } else if (PLAN > 0)
+            planCapacity(
+                    test_case_number + 1,
+                    MAX_TEST_CASE_DURATION,
+                    num_producers,
+                    test_case,
+                    PLAN,
+                    SLO_REPEATS,
+                    PLAN_MAX_CONSUMERS);
+        else if (SLO > 0)
+            searchCapacity(
+                    test_case_number + 1,
+                    MAX_TEST_CASE_DURATION,
+                    num_producers,
+                    num_consumers,
+                    test_case,
+                    SLO,
+                    SLO_REPEATS);
+        else if (TEMPLATE_WAIT)
+            executeTemplate(
+                    test_case_number + 1,
+                    MAX_TEST_CASE_DURATION,
+                    num_producers,
+                    num_consumers,
+                    test_case,
+                    TEMPLATE_WAIT);
+        else if (STRESS_ROUNDS > 0)
+            stress(
+                    test_case_number + 1,
+                    STRESS_ROUNDS,
+                    STRESS_OPERATIONS,
+                    num_producers,
+                    num_consumers,
+                    test_case);
+        else
+            execute(
+                    test_case_number + 1,
+                    MAX_TEST_CASE_DURATION,
+                    num_producers,
+                    num_consumers,
+                    test_case);
+
+        test_case->result.seed = test_case->seed;
+
+        if (child <= 0)
+            results[test_case_number] = test_case->result;
+
+        if (child == 0 && ISOLATE) {
+            reportResult(channel, &test_case->result);
+            exit(0);
+        }
 
         printf("\n");
 
-        free(test_case->buf);
         free(test_case);
         free(data);
+
+        if (stopRequested())
+            break;
     }
 
+    if (ISOLATE)
+        printSummary(results, ran, number_of_lines);
+
+    free(results);
+    free(ran);
     free(lines);
 
     return 0;
@@ -0,0 +1,371 @@
+/**
+ * The types and functions shared by the simulator and its stress harness.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "queue.h"
+#include "payload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Item Item;
+typedef struct TestCase TestCase;
+typedef struct Worker Worker;
+typedef struct Bitmap Bitmap;
+typedef struct Latency Latency;
+
+/**
+ * Represents a single item placed in the buffer by a producer.
+ *
+ * Each item is stamped with the producer that produced it and that producer's sequence
+ * number so that consumers can verify that no item was lost, duplicated or reordered.
+ * With a payload, the item is followed in the buffer by the payload's bytes.
+ */
+struct Item
+{
+    int value;             // The random number carried by the item.
+    int producer_id;       // The producer that produced the item.
+    unsigned int sequence; // The producer's sequence number of the item.
+    uint32_t checksum;     // (With a payload) The checksum of the payload.
+    unsigned int key;      // (Keyed test cases) The key whose items must be processed in order.
+    long long pushed_at;   // The CLOCK_MONOTONIC time (in nanoseconds) at which the producer pushed the item.
+    long long expires;     // (With a TTL) The time after which the item is stale (0 for never).
+    unsigned int size;     // The number of bytes of the item and its payload.
+};
+
+/**
+ * A growable set of sequence numbers (one bit per sequence number).
+ */
+struct Bitmap
+{
+    uint64_t *words;
+    size_t num_words;
+};
+
+#define LATENCY_BUCKETS 256   // Four buckets per power of two of nanoseconds.
+#define BATCH_SIZE_BUCKETS 16 // One bucket per power of two of items.
+
+/**
+ * A histogram of latencies, precise to within a quarter of a power of two.
+ */
+struct Latency
+{
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long samples;
+    long long total; // The sum of the latencies in nanoseconds.
+    long long max;
+};
+
+/**
+ * The outcome of a test case, as reported by a test case run in a child process.
+ */
+typedef struct TestCaseResult
+{
+    bool verified;          // Whether 'verify' ran (and the fields below are set).
+    bool passed;
+    unsigned long produced;
+    unsigned long consumed;
+    unsigned long lost;     // Including the items coalesced or dropped by design.
+    unsigned long duplicates;
+    unsigned long out_of_order;
+    unsigned long corrupt;
+    double throughput;      // The items consumed per second.
+    long long p99;          // An upper bound of the 99th percentile latency in nanoseconds (0 if not measured).
+    unsigned long long seed; // The seed the test case ran with.
+} TestCaseResult;
+
+/**
+ * How long a test case's threads took to spawn and the memory they added to the process.
+ */
+typedef struct ThreadSpawn
+{
+    int threads;           // The number of producer and consumer threads created.
+    int failed;            // The number of threads that could not be created.
+    long long elapsed;     // The time taken to create them, in nanoseconds.
+    size_t virtual_bytes;  // The growth of the address space.
+    size_t resident_bytes; // The growth of the resident set.
+    size_t stack_size;     // The stack size the threads were created with.
+    size_t guard_size;     // The guard size the threads were created with.
+} ThreadSpawn;
+
+/**
+ * The scheduling settings of a test case's producer or consumer threads, applied by every
+ * thread to itself as it starts, and how many threads the system refused them to.
+ */
+typedef struct ThreadSchedule
+{
+    int policy;        // SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO or SCHED_RR.
+    int priority;      // (SCHED_FIFO and SCHED_RR) The static priority.
+    int nice;          // The nice level (0 for the default).
+    int rejected;      // The threads left on SCHED_OTHER because the policy was refused.
+    int policy_error;  // Why the policy was last refused (an errno value).
+    int nice_rejected; // The threads whose nice level was refused.
+    int nice_error;    // Why the nice level was last refused (an errno value).
+} ThreadSchedule;
+
+/**
+ * The independent random number streams of a worker, each seeded from the run's seed.
+ */
+typedef enum RandomStream
+{
+    RANDOM_ARRIVALS, // (Producers) The sleeps between items.
+    RANDOM_SERVICE,  // (Consumers) The service times and sleeps.
+    RANDOM_ITEMS     // (Producers) The values, keys and payload sizes of the items.
+} RandomStream;
+
+/**
+ * The states a producer or consumer thread can be observed in by the watchdog.
+ */
+typedef enum WorkerState
+{
+    WORKER_RUNNING,
+    WORKER_ACQUIRING,     // Blocked acquiring 'lock'.
+    WORKER_WAITING_FULL,  // Blocked because the buffer is full.
+    WORKER_WAITING_EMPTY, // Blocked because the buffer is empty.
+    WORKER_SLEEPING,
+    WORKER_EXITED
+} WorkerState;
+
+/**
+ * How the time a consumer takes to process an item is distributed around 'service_time'.
+ */
+typedef enum ServiceDistribution
+{
+    SERVICE_FIXED,       // Always 'service_time'.
+    SERVICE_EXPONENTIAL, // Exponential with mean 'service_time'.
+    SERVICE_UNIFORM      // Uniform between 0 and twice 'service_time'.
+} ServiceDistribution;
+
+/**
+ * The fault a test case injects into its run, for 'fault_for' from 'fault_at' after it starts.
+ */
+typedef enum FaultKind
+{
+    FAULT_NONE,
+    FAULT_FREEZE, // The first consumer stops consuming.
+    FAULT_BURST,  // The first producer produces 'fault_factor' times faster (without sleeping, unless paced by a rate).
+    FAULT_SLOW    // The first consumer sleeps or serves items 'fault_factor' times longer.
+} FaultKind;
+
+/**
+ * When an item was pushed relative to a test case's fault.
+ */
+typedef enum FaultPhase
+{
+    FAULT_BEFORE,
+    FAULT_DURING,
+    FAULT_AFTER
+} FaultPhase;
+
+/**
+ * Represents a given test case associated with each line within the given configuration file.
+ */
+struct TestCase
+{
+    int BSIZE;					 // The maximum size of the buffer.
+    int producer_sleep_duration; // The amount of time a producer should sleep for.
+    int consumer_sleep_duration; // The amount of time a consumer should sleep for.
+    bool terminated;
+    bool quiet;                  // Suppresses the per-item log lines.
+
+    const Engine *engine;        // The engine moving items through the buffer.
+    QueueLayout layout;          // The slot alignment and prefetch distance of the buffer.
+
+    size_t payload_size;           // The (maximum) number of payload bytes following each item (0 for none).
+    size_t payload_min;            // The minimum number of payload bytes, when payloads vary in size (0 for fixed size payloads).
+    PayloadChecksum checksum;      // How consumers verify the payloads.
+    const PayloadKernel *kernel;   // The kernels filling and checksumming the payloads.
+
+    int num_keys;           // The number of distinct keys, each routed to one consumer's partition (0 for a single shared buffer).
+    double zipf;            // The Zipf exponent of the keys' popularity (0 for uniform keys).
+    double *key_cdf;        // The cumulative probability of each key.
+    Queue *partitions;      // One queue per consumer (or the buffers of a queue pool), used instead of 'queue' (NULL unless keyed or pooled).
+    int num_partitions;
+    int *key_owner;         // The consumer of each key (-1 until its first item is consumed).
+    long long *key_last;    // The last sequence number consumed per key and producer (-1 if none).
+
+    long long ttl;          // How long (in nanoseconds) an item stays fresh (0 for forever).
+    int sweep_interval;     // How often (in milliseconds) the sweeper trims expired items from the buffer(s) (0 for no sweeper).
+    Worker *sweeper;        // (With a sweeper) Records the items it removed, like a consumer, for 'verify'.
+
+    int batch_size;         // The number of items a consumer collects before processing them (0 or 1 for no batching).
+    int linger;             // How long (in microseconds) a consumer waits for its batch to fill after its first item.
+    double rate;            // The items offered per second by all producers together, at regular intervals (0: producers sleep instead).
+    long long service_time; // How long (in nanoseconds) a consumer takes to process an item (0: consumers sleep instead).
+    ServiceDistribution service_distribution;
+    size_t stack_size;      // The stack size of the producer and consumer threads in bytes (0 for the default).
+    long guard_size;        // The guard size of their stacks in bytes (-1 for the default).
+    ThreadSpawn spawn;      // Measured by 'execute' while creating the threads.
+    ThreadSchedule producer_schedule;
+    ThreadSchedule consumer_schedule;
+    unsigned long long seed; // The run's seed, from which every worker's random number streams are derived.
+    bool unordered;         // (Queue pools) Whether a producer's items travel through several buffers, so their order is not checked.
+    FaultKind fault;        // The fault injected into the run (FAULT_NONE for none).
+    long long fault_at;     // When (in nanoseconds after the start) the fault begins.
+    long long fault_for;    // How long (in nanoseconds) the fault lasts.
+    int fault_factor;       // (Bursts and slowdowns) How many times faster the producer or slower the consumer gets.
+    int *depth_samples;     // (With a fault) The number of items in the buffer(s), sampled at regular intervals.
+    int num_depth_samples;
+    int max_depth_samples;
+    Queue queue;                 // The buffer, initialized for the duration of 'execute'.
+
+    int watchdog_interval;  // The number of seconds without progress before a stall is reported (0 disables the watchdog).
+    bool watchdog_abort;    // Whether a detected stall aborts the test case.
+    bool finished;          // Set once every producer and consumer thread has been joined.
+    unsigned long progress; // The number of items produced and consumed so far.
+    long long started;      // The CLOCK_MONOTONIC timestamp (in nanoseconds) at which the test case started.
+
+    Worker *workers;
+    int num_workers;
+    int num_producers;      // The first 'num_producers' workers are producers, the rest are consumers.
+
+    TestCaseResult result;  // Filled in by 'verify' and 'reportLatency'.
+
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_flag;
+};
+
+/**
+ * Represents the observable state of a single producer or consumer thread.
+ *
+ * The owning thread updates these fields with relaxed atomic stores so that the watchdog
+ * can read them at any time without taking part in the test case's locking.
+ */
+struct Worker
+{
+    TestCase *test_case;
+    int id;
+    bool is_producer;
+
+    WorkerState state;
+    QueueLock lock;
+    long long last_op;       // The CLOCK_MONOTONIC timestamp (in nanoseconds) of the last item produced or consumed.
+    unsigned long operations;
+
+    unsigned int sequence;    // (Producers) The sequence number stamped on the next item.
+    unsigned int arrival_seed; // (Producers) The state of the RANDOM_ARRIVALS stream.
+    unsigned int item_seed;    // (Producers) The state of the RANDOM_ITEMS stream.
+    unsigned int service_seed; // (Consumers) The state of the RANDOM_SERVICE stream.
+
+    Bitmap *seen;             // (Consumers) The sequence numbers consumed from each producer.
+    long long *last_sequence; // (Consumers) The last sequence number consumed from each producer (-1 if none).
+    unsigned long duplicates;
+    unsigned long out_of_order;
+    unsigned long corrupt;    // Items carrying a producer id that does not exist, or a payload failing its checksum.
+    unsigned long misrouted;  // (Keyed test cases) Items of a key already consumed by another consumer.
+    unsigned long key_out_of_order; // (Keyed test cases) Items consumed after a later item of the same key and producer.
+    unsigned long expired;    // (Consumers) Items discarded unprocessed because their TTL had passed.
+    Latency latency;          // (Consumers) The time from push to processing of the items processed.
+    unsigned long batches;      // (Batching consumers) The number of batches collected.
+    unsigned long full_batches; // (Batching consumers) The batches that filled up before the linger time passed.
+    long long batch_wait;       // (Batching consumers) The total time (in nanoseconds) items waited in a batch.
+    unsigned long batch_sizes[BATCH_SIZE_BUCKETS]; // (Batching consumers) The number of batches by power of two of their size.
+    Latency fault_latency[FAULT_AFTER + 1]; // (Consumers, with a fault) The latency of the items pushed before, during and after the fault.
+};
+
+bool initClock(const char *source);
+void reportClock(void);
+long long now(void);
+void setWorkerState(Worker *worker, WorkerState state, QueueLock lock);
+void observe(const Queue *queue, QueueEvent event, QueueLock lock);
+
+char **split(char *str, char tokens);
+char *trim(char *str);
+char **readFile(char * path, int number_of_lines);
+int numberOfLinesInFile(char * path);
+
+const char *serviceDistributionName(ServiceDistribution distribution);
+unsigned int deriveSeed(unsigned long long seed, const Worker *worker, RandomStream stream);
+void *produce(void *argv);
+void *consume(void *argv);
+bool setBit(Bitmap *bitmap, unsigned int bit);
+void recordItem(Worker *consumer, Item item);
+void verify(TestCase *test_case);
+
+void *watch(void *argv);
+void dumpThreadStates(TestCase *test_case);
+bool initWorkers(TestCase *test_case, int num_producers, int num_consumers);
+void freeWorkers(TestCase *test_case);
+void execute(int test_case_number, int duration, int num_producers, int num_consumers, TestCase *test_case);
+
+bool initPartitions(TestCase *test_case, int num_producers, int num_consumers, size_t item_size);
+void destroyPartitions(TestCase *test_case);
+int numTestCaseQueues(const TestCase *test_case);
+Queue *testCaseQueue(TestCase *test_case, int index);
+unsigned int drawKey(const TestCase *test_case, unsigned int *seed);
+Queue *partitionOf(TestCase *test_case, unsigned int key);
+void recordKey(Worker *consumer, Item item);
+void reportPartitions(TestCase *test_case);
+
+void recordLatency(Latency *latency, long long nanoseconds);
+void mergeLatency(Latency *into, const Latency *from);
+long long latencyPercentile(const Latency *latency, double fraction);
+void reportLatency(TestCase *test_case);
+
+bool itemExpired(const TestCase *test_case, const Item *item, long long current_time);
+bool initSweeper(TestCase *test_case);
+void freeSweeper(TestCase *test_case);
+void *sweep(void *argv);
+void reportExpiry(TestCase *test_case);
+
+int collectBatch(Worker *consumer, Queue *queue, unsigned char *records);
+void reportBatches(TestCase *test_case);
+
+void stress(int test_case_number, int rounds, int operations, int num_producers, int num_consumers, TestCase *test_case);
+
+void serveQueues(int test_case_number, int duration, int num_producers, int num_consumers, int num_queues, TestCase *test_case);
+
+void processMemory(size_t *virtual_bytes, size_t *resident_bytes);
+void initThreadAttributes(const TestCase *test_case, pthread_attr_t *attr);
+void beginSpawn(TestCase *test_case);
+void endSpawn(TestCase *test_case, const pthread_attr_t *attr, int spawned, int failed);
+void reportThreads(TestCase *test_case);
+bool parseSchedulePolicy(const char *name, int *policy);
+const char *schedulePolicyName(int policy);
+bool scheduleSet(const ThreadSchedule *schedule);
+const char *checkSchedule(ThreadSchedule *schedule);
+void applySchedule(Worker *worker);
+
+const char *faultName(FaultKind fault);
+bool faultActive(const TestCase *test_case, long long time);
+FaultPhase faultPhase(const TestCase *test_case, long long time);
+bool initFault(TestCase *test_case, int duration);
+void freeFault(TestCase *test_case);
+void freezeWorker(Worker *worker);
+void *sampleDepth(void *argv);
+void reportFault(TestCase *test_case);
+
+void planCapacity(int test_case_number, int duration, int num_producers, TestCase *test_case, double slo, int repeats, int max_consumers);
+void searchCapacity(int test_case_number, int duration, int num_producers, int num_consumers, TestCase *test_case, double slo, int repeats);
+
+bool startSignalThread(void);
+void watchTestCase(TestCase *test_case);
+void watchChild(pid_t child);
+bool stopRequested(void);
+void printSnapshot(TestCase *test_case);
+
+pid_t forkTestCase(int *channel);
+void reportResult(int channel, const TestCaseResult *result);
+bool awaitTestCase(int test_case_number, pid_t child, int channel, int timeout, TestCaseResult *result);
+void printSummary(const TestCaseResult *results, const bool *ran, int number_of_test_cases);
+
+bool executeTemplate(int test_case_number, int duration, int num_producers, int num_consumers, TestCase *test_case, const char *wait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIMULATOR_H
@@ -0,0 +1,282 @@
+/**
+ * Capacity search: finds the highest rate a test case's producers can offer while the p99
+ * latency stays within an SLO and no item is lost, by running the test case (with 'execute')
+ * at increasing rates until one fails, then bisecting between the last rate that passed and
+ * the first that failed.
+ *
+ * Capacity planning turns the question around: at the test case's rate and service time, it
+ * finds the fewest consumers, and then the smallest power of two BSIZE, that meet the SLO.
+ *
+ * Every probe runs the test case several times, quietly, and passes when most of its runs
+ * do: a run passes when it verifies, loses nothing, keeps up with the offered rate and has
+ * its p99 latency within the SLO. The search prints one line per probe and the capacity.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "simulator.h"
+
+#define INITIAL_RATE 100.0    // The first rate probed (items/s) when the test case sets none.
+#define MAX_RATE 1e8          // The rate above which the search stops doubling.
+#define MIN_RATE 1.0          // The rate below which the search gives up.
+#define PRECISION 1.05        // The search stops once the failing rate is within 5% of the passing one.
+#define KEEP_UP_FRACTION 0.9  // The share of the offered rate a run must consume to keep up.
+#define MAX_PLAN_BSIZE_LOG 12 // Plans consider buffers of up to 2^12 items.
+
+/**
+ * The parameters of a capacity search.
+ */
+typedef struct Search
+{
+    int test_case_number;
+    int duration;
+    int num_producers;
+    int num_consumers;
+    TestCase *test_case;
+    long long slo;       // The p99 latency target in nanoseconds.
+    int repeats;         // The number of runs per probe.
+    TestCaseResult best; // The result of a run of the highest rate that passed.
+} Search;
+
+/**
+ * Redirects the standard output to /dev/null.
+ *
+ * @return A duplicate of the original standard output, for 'restoreOutput' (-1 on failure).
+ */
+static int silenceOutput(void)
+{
+    int null = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+
+    if (null < 0) {
+        perror("open");
+        return -1;
+    }
+
+    int saved = dup(STDOUT_FILENO);
+
+    if (saved >= 0)
+        dup2(null, STDOUT_FILENO);
+
+    close(null);
+
+    return saved;
+}
+
+/**
+ * Restores the standard output redirected by 'silenceOutput'.
+ */
+static void restoreOutput(int saved)
+{
+    if (saved < 0)
+        return;
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+/**
+ * Orders latencies for 'qsort'.
+ */
+static int compareLatencies(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Runs a test case at a given rate as many times as the search repeats a probe.
+ *
+ * @return Whether most of the runs met the SLO.
+ */
+static bool probe(Search *search, double rate)
+{
+    long long p99s[search->repeats];
+    double throughput = 0;
+    int runs = 0;
+    int passed = 0;
+    TestCaseResult last;
+
+    for (; runs < search->repeats && !stopRequested(); runs++) {
+        TestCase run = *search->test_case;
+
+        run.rate = rate;
+        run.quiet = true;
+
+        int saved = silenceOutput();
+        execute(search->test_case_number, search->duration, search->num_producers, search->num_consumers, &run);
+        restoreOutput(saved);
+
+        TestCaseResult *result = &run.result;
+        bool met = result->verified && result->passed && !result->lost && result->consumed && result->p99 <= search->slo &&
+                   result->throughput >= KEEP_UP_FRACTION * rate;
+
+        p99s[runs] = result->verified ? result->p99 : 0;
+        throughput += result->throughput;
+        passed += met;
+        last = *result;
+    }
+
+    if (!runs)
+        return false;
+
+    qsort(p99s, runs, sizeof(long long), compareLatencies);
+
+    bool sustained = passed * 2 > runs;
+
+    printf("\tProbe: bufferSize = %d, num_consumers = %d, rate = %.1f items/s, throughput = %.1f items/s, median p99 <= %.3f ms, %d/%d runs within the SLO (%s)\n",
+           search->test_case->BSIZE, search->num_consumers, rate, throughput / runs, p99s[runs / 2] / 1e6, passed, runs, sustained ? "PASS" : "FAIL");
+    fflush(stdout);
+
+    if (sustained) {
+        search->best = last;
+        search->best.p99 = p99s[runs / 2];
+    }
+
+    return sustained;
+}
+
+/**
+ * Searches the highest rate at which a test case meets a p99 latency SLO without losing
+ * items, then prints it.
+ *
+ * @param test_case_number The current test case number.
+ * @param duration The duration of every run.
+ * @param num_producers The number of producers.
+ * @param num_consumers The number of consumers.
+ * @param test_case The test case; its rate, if any, is the first one probed.
+ * @param slo The p99 latency target in milliseconds.
+ * @param repeats The number of runs per probe.
+ */
+void searchCapacity(int test_case_number, int duration, int num_producers, int num_consumers, TestCase *test_case, double slo, int repeats)
+{
+    Search search = {test_case_number, duration, num_producers, num_consumers, test_case, (long long)(slo * 1e6), repeats > 0 ? repeats : 1, {0}};
+    double passing = 0; // The highest rate that passed (0 for none yet).
+    double failing = 0; // The lowest rate that failed (0 for none yet).
+    double rate = test_case->rate > 0 ? test_case->rate : INITIAL_RATE;
+
+    printf("Capacity Test Case %d\n", test_case_number);
+    printf("\tbufferSize = %d, num_producers = %d, num_consumers = %d, engine = %s, service = %lld us, slo = p99 <= %.3f ms, runs per probe = %d, duration = %d s \n",
+           test_case->BSIZE, num_producers, num_consumers, test_case->engine->name, test_case->service_time / 1000, slo, search.repeats, duration);
+
+    if (num_producers <= 0 || num_consumers <= 0) {
+        printf("\tNothing to search\n");
+        return;
+    }
+
+    // Double the rate until it fails (or halve it until it passes)...
+    while (!stopRequested() && rate <= MAX_RATE && rate >= MIN_RATE) {
+        if (probe(&search, rate)) {
+            passing = rate;
+
+            if (failing)
+                break;
+
+            rate *= 2;
+        } else {
+            failing = rate;
+
+            if (passing)
+                break;
+
+            rate /= 2;
+        }
+    }
+
+    // ...then bisect between the two.
+    while (!stopRequested() && passing && failing && failing / passing > PRECISION) {
+        rate = (passing + failing) / 2;
+
+        if (probe(&search, rate))
+            passing = rate;
+        else
+            failing = rate;
+    }
+
+    test_case->result = search.best;
+
+    if (!passing)
+        printf("\tCapacity: no rate of at least %.1f items/s meets the SLO\n", MIN_RATE);
+    else if (!failing)
+        printf("\tCapacity: at least %.1f items/s (every rate probed met the SLO)\n", passing);
+    else
+        printf("\tCapacity: %.1f items/s with p99 <= %.3f ms (%.1f items/s failed)%s\n", passing, search.best.p99 / 1e6, failing,
+               failing / passing > PRECISION ? " (interrupted)" : "");
+}
+
+/**
+ * Searches the cheapest configuration, in consumers first and then in BSIZE, with which a
+ * test case meets a p99 latency SLO at its rate without losing items, then prints it as a
+ * configuration row.
+ *
+ * @param test_case_number The current test case number.
+ * @param duration The duration of every run.
+ * @param num_producers The number of producers.
+ * @param test_case The test case, with a rate and a service time.
+ * @param slo The p99 latency target in milliseconds.
+ * @param repeats The number of runs per configuration probed.
+ * @param max_consumers The most consumers to consider.
+ */
+void planCapacity(int test_case_number, int duration, int num_producers, TestCase *test_case, double slo, int repeats, int max_consumers)
+{
+    TestCase candidate = *test_case;
+    Search search = {test_case_number, duration, num_producers, 0, &candidate, (long long)(slo * 1e6), repeats > 0 ? repeats : 1, {0}};
+    double load = test_case->rate * test_case->service_time / 1e9; // The number of consumers the items keep busy on average.
+
+    printf("Plan Test Case %d\n", test_case_number);
+    printf("\tnum_producers = %d, engine = %s, rate = %.1f items/s, service = %lld us (%s), load = %.2f consumers, slo = p99 <= %.3f ms, runs per probe = %d, duration = %d s \n",
+           num_producers, test_case->engine->name, test_case->rate, test_case->service_time / 1000, serviceDistributionName(test_case->service_distribution), load, slo,
+           search.repeats, duration);
+
+    if (num_producers <= 0 || test_case->rate <= 0 || !test_case->service_time) {
+        printf("\tA plan needs producers, a rate and a service time\n");
+        return;
+    }
+
+    if (test_case->engine->single_consumer && max_consumers > 1)
+        max_consumers = 1;
+
+    // Fewer consumers than the load could never keep up, however large the buffer.
+    for (int consumers = (int)load + 1; consumers <= max_consumers && !stopRequested(); consumers++) {
+        search.num_consumers = consumers;
+        candidate.BSIZE = 1 << MAX_PLAN_BSIZE_LOG;
+
+        if (!probe(&search, test_case->rate))
+            continue;
+
+        // The largest buffer meets the SLO, so bisect (by powers of two) the smallest one that does.
+        int passing = MAX_PLAN_BSIZE_LOG;
+        int failing = -1;
+
+        while (passing - failing > 1 && !stopRequested()) {
+            int middle = (passing + failing) / 2;
+
+            candidate.BSIZE = 1 << middle;
+
+            if (probe(&search, test_case->rate))
+                passing = middle;
+            else
+                failing = middle;
+        }
+
+        test_case->result = search.best;
+
+        printf("\tPlan: num_consumers = %d, bufferSize = %d, utilization = %.1f%%, p99 <= %.3f ms%s\n", consumers, 1 << passing, 100.0 * load / consumers,
+               search.best.p99 / 1e6, passing - failing > 1 ? " (interrupted)" : "");
+        printf("\tRow: %d,%d,%d,%d,%d,engine=%s,rate=%g,service=%lld,service_dist=%s\n", 1 << passing, test_case->producer_sleep_duration, test_case->consumer_sleep_duration,
+               num_producers, consumers, test_case->engine->name, test_case->rate, test_case->service_time / 1000, serviceDistributionName(test_case->service_distribution));
+        return;
+    }
+
+    printf("\tPlan: no configuration with at most %d consumers meets the SLO\n", max_consumers);
+}
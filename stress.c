@@ -0,0 +1,586 @@
+/**
+ * A linearizability stress harness for the queue engines.
+ *
+ * Each round runs the test case's producers and consumers back to back (without sleeping)
+ * on a fresh buffer. Every producer pushes '--stress-ops' uniquely stamped items and the
+ * consumers pop exactly as many items in total. Every push and pop records the logical
+ * times at which it was invoked and at which it returned, taken from a shared counter so
+ * that the times are totally ordered and consistent with real time. Threads randomly
+ * yield, spin or sleep between operations to perturb the interleaving.
+ *
+ * Once a round is over its history is checked against the sequential specification of a
+ * bounded FIFO queue. Because every item is unique, a history is linearizable with
+ * respect to an (unbounded) FIFO queue exactly when none of the following occurs
+ * (Henzinger, Sezgin and Vafeiadis, "Aspect-Oriented Linearizability Proofs", 2013):
+ *
+ *  - fresh:     an item is popped that was never pushed, or before its push was invoked;
+ *  - repeated:  an item is popped more than once;
+ *  - reordered: the push of 'a' returned before the push of 'b' was invoked, yet the pop
+ *               of 'b' returned before the pop of 'a' was invoked.
+ *
+ * Since pops block instead of reporting an empty queue, the remaining aspect (popping
+ * "empty" while an item is definitely present) cannot occur. The capacity bound is checked
+ * separately: an item is definitely in the queue between the return of its push and the
+ * invocation of its pop, so more than BSIZE such intervals overlapping is a violation.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+
+#include "simulator.h"
+
+#define STRESS_STALL 2        // The number of seconds without progress after which a round is considered wedged.
+#define MAX_REPORTED_ROUNDS 10
+
+typedef struct Stress Stress;
+typedef struct StressThread StressThread;
+typedef struct Operation Operation;
+typedef struct Violations Violations;
+
+/**
+ * A single push or pop recorded by the stress harness.
+ */
+struct Operation
+{
+    long long invoked;  // The logical time at which the operation was invoked.
+    long long returned; // The logical time at which the operation returned.
+    Item item;
+};
+
+/**
+ * The state shared by every thread of a stress round.
+ */
+struct Stress
+{
+    TestCase *test_case;
+    int operations;  // The number of items pushed by each producer.
+    long long clock; // The logical clock, incremented on every invocation and response.
+    long remaining;  // The number of pops not yet claimed by a consumer.
+    int running;     // The number of threads that have not exited yet.
+};
+
+/**
+ * A producer or consumer thread of a stress round together with its history.
+ */
+struct StressThread
+{
+    int id;
+    Stress *stress;
+    unsigned int seed;
+
+    Operation *history;
+    size_t length;
+    size_t capacity;
+};
+
+/**
+ * The outcome of checking the history of a stress round.
+ */
+struct Violations
+{
+    bool wedged; // Whether the round had to be terminated because it stopped making progress.
+    unsigned long fresh;
+    unsigned long repeated;
+    unsigned long reordered;
+    unsigned long lost;
+    int max_size; // The largest number of items definitely in the buffer at the same time.
+    char example[200];
+};
+
+/**
+ * Randomly perturbs the interleaving of the calling thread by yielding the processor,
+ * spinning or sleeping for a short while (or doing nothing).
+ *
+ * @param seed The calling thread's random number generator state.
+ */
+static void perturb(unsigned int *seed)
+{
+    switch (rand_r(seed) % 8)
+    {
+        case 0:
+            sched_yield();
+            break;
+        case 1: {
+            volatile int spin = rand_r(seed) % 2000;
+
+            while (spin > 0)
+                spin--;
+
+            break;
+        }
+        case 2: {
+            struct timespec pause = {0, 1000 + rand_r(seed) % 50000};
+
+            nanosleep(&pause, NULL);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * Appends an operation to a thread's history.
+ *
+ * @param thread The thread that performed the operation.
+ * @param operation The operation.
+ *
+ * @return Whether the operation could be recorded.
+ */
+static bool record(StressThread *thread, Operation operation)
+{
+    if (thread->length == thread->capacity) {
+        size_t capacity = thread->capacity ? thread->capacity * 2 : 256;
+        Operation *history = (Operation *)realloc(thread->history, sizeof(Operation) * capacity);
+
+        if (!history) {
+            perror("realloc");
+            return false;
+        }
+
+        thread->history = history;
+        thread->capacity = capacity;
+    }
+
+    thread->history[thread->length++] = operation;
+
+    return true;
+}
+
+/**
+ * Marks the calling thread as exited and notifies the round driver.
+ *
+ * @param thread The exiting thread.
+ */
+static void leave(StressThread *thread)
+{
+    TestCase *test_case = thread->stress->test_case;
+
+    pthread_mutex_lock(&(test_case->done_lock));
+    thread->stress->running--;
+    pthread_cond_signal(&(test_case->done_flag));
+    pthread_mutex_unlock(&(test_case->done_lock));
+}
+
+/**
+ * The function used with a stress producer thread: pushes 'operations' items, recording
+ * the invocation and response time of every push.
+ *
+ * @param argv The producer's stress thread.
+ */
+static void *stressProduce(void *argv)
+{
+    StressThread *thread = (StressThread *)argv;
+    Stress *stress = thread->stress;
+    TestCase *test_case = stress->test_case;
+
+    for (int i = 0; i < stress->operations; i++)
+    {
+        Operation operation;
+
+        // Byte-budgeted engines read the record length from the item's 'size'.
+        memset(&operation, 0, sizeof(operation));
+        perturb(&thread->seed);
+
+        operation.item.size = sizeof(Item);
+        operation.item.value = rand_r(&thread->seed) % 201;
+        operation.item.producer_id = thread->id;
+        operation.item.sequence = i;
+        operation.invoked = __atomic_fetch_add(&stress->clock, 1, __ATOMIC_SEQ_CST);
+
+        if (!queuePush(&test_case->queue, &operation.item))
+            break;
+
+        operation.returned = __atomic_fetch_add(&stress->clock, 1, __ATOMIC_SEQ_CST);
+
+        if (!record(thread, operation))
+            break;
+
+        __atomic_add_fetch(&test_case->progress, 1, __ATOMIC_RELAXED);
+    }
+
+    leave(thread);
+
+    return NULL;
+}
+
+/**
+ * The function used with a stress consumer thread: pops items until every pushed item has
+ * been claimed by a consumer, recording the invocation and response time of every pop.
+ *
+ * @param argv The consumer's stress thread.
+ */
+static void *stressConsume(void *argv)
+{
+    StressThread *thread = (StressThread *)argv;
+    Stress *stress = thread->stress;
+    TestCase *test_case = stress->test_case;
+
+    while (__atomic_sub_fetch(&stress->remaining, 1, __ATOMIC_RELAXED) >= 0)
+    {
+        Operation operation;
+
+        perturb(&thread->seed);
+
+        operation.invoked = __atomic_fetch_add(&stress->clock, 1, __ATOMIC_SEQ_CST);
+
+        if (!queuePop(&test_case->queue, &operation.item))
+            break;
+
+        operation.returned = __atomic_fetch_add(&stress->clock, 1, __ATOMIC_SEQ_CST);
+
+        if (!record(thread, operation))
+            break;
+
+        __atomic_add_fetch(&test_case->progress, 1, __ATOMIC_RELAXED);
+    }
+
+    leave(thread);
+
+    return NULL;
+}
+
+static const long long *sort_keys;
+
+/**
+ * Orders item indices by the key they refer to in 'sort_keys' (for qsort).
+ */
+static int compareByKey(const void *a, const void *b)
+{
+    long long x = sort_keys[*(const int *)a];
+    long long y = sort_keys[*(const int *)b];
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Orders capacity events by their logical time (for qsort).
+ */
+static int compareEvents(const void *a, const void *b)
+{
+    long long x = ((const long long *)a)[0];
+    long long y = ((const long long *)b)[0];
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Checks the history of a stress round against the sequential specification of a bounded
+ * FIFO queue (see the top of this file).
+ *
+ * @param threads The producer threads followed by the consumer threads of the round.
+ * @param num_producers The number of producers.
+ * @param num_consumers The number of consumers.
+ * @param operations The number of items each producer tried to push.
+ * @param capacity The capacity of the buffer.
+ * @param violations Receives the violations found in the history.
+ */
+static void check(StressThread *threads, int num_producers, int num_consumers, int operations, int capacity, Violations *violations)
+{
+    int num_items = num_producers * operations;
+    long long *push_invoked = (long long *)malloc(sizeof(long long) * num_items);
+    long long *push_returned = (long long *)malloc(sizeof(long long) * num_items);
+    long long *pop_invoked = (long long *)malloc(sizeof(long long) * num_items);
+    long long *pop_returned = (long long *)malloc(sizeof(long long) * num_items);
+    int *order = (int *)malloc(sizeof(int) * num_items);
+    long long (*events)[2] = malloc(sizeof(long long[2]) * 2 * num_items);
+
+    if (!push_invoked || !push_returned || !pop_invoked || !pop_returned || !order || !events) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (int i = 0; i < num_items; i++) {
+        push_invoked[i] = push_returned[i] = -1;
+        pop_invoked[i] = pop_returned[i] = -1;
+    }
+
+    for (int producer = 0; producer < num_producers; producer++) {
+        for (size_t i = 0; i < threads[producer].length; i++) {
+            int index = producer * operations + (int)i;
+
+            push_invoked[index] = threads[producer].history[i].invoked;
+            push_returned[index] = threads[producer].history[i].returned;
+        }
+    }
+
+    // Fresh and repeated items.
+    for (int consumer = num_producers; consumer < num_producers + num_consumers; consumer++) {
+        for (size_t i = 0; i < threads[consumer].length; i++) {
+            Operation *pop = &threads[consumer].history[i];
+            Item item = pop->item;
+            bool valid = item.producer_id >= 0 && item.producer_id < num_producers && item.sequence < (unsigned int)operations;
+            int index = valid ? item.producer_id * operations + (int)item.sequence : 0;
+
+            if (!valid || push_invoked[index] < 0 || pop->returned < push_invoked[index]) {
+                if (!violations->fresh++ && !violations->example[0])
+                    snprintf(violations->example, sizeof(violations->example), "item %d:%u popped at [%lld, %lld] was never pushed before", item.producer_id, item.sequence, pop->invoked, pop->returned);
+                continue;
+            }
+
+            if (pop_returned[index] >= 0) {
+                if (!violations->repeated++ && !violations->example[0])
+                    snprintf(violations->example, sizeof(violations->example), "item %d:%u popped at [%lld, %lld] and again at [%lld, %lld]", item.producer_id, item.sequence, pop_invoked[index], pop_returned[index], pop->invoked, pop->returned);
+                continue;
+            }
+
+            pop_invoked[index] = pop->invoked;
+            pop_returned[index] = pop->returned;
+        }
+    }
+
+    // Reordered items: sort the pushed items by the time their push returned, so that the
+    // items whose push returned before the push of 'b' was invoked form a prefix.
+    int num_pushed = 0;
+
+    for (int i = 0; i < num_items; i++) {
+        if (push_returned[i] >= 0)
+            order[num_pushed++] = i;
+    }
+
+    sort_keys = push_returned;
+    qsort(order, num_pushed, sizeof(int), compareByKey);
+
+    // latest[k] is the item with the latest pop invocation among the first k + 1 items.
+    int *latest = (int *)malloc(sizeof(int) * (num_pushed ? num_pushed : 1));
+
+    if (!latest) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (int k = 0; k < num_pushed; k++) {
+        int item = order[k];
+
+        // An item that was pushed but never popped in a completed round was lost; treat its
+        // pop as happening after every other one.
+        if (pop_returned[item] < 0 && !violations->wedged) {
+            if (!violations->lost++ && !violations->example[0])
+                snprintf(violations->example, sizeof(violations->example), "item %d:%d pushed at [%lld, %lld] was never popped", item / operations, item % operations, push_invoked[item], push_returned[item]);
+            pop_invoked[item] = LLONG_MAX;
+        }
+
+        latest[k] = k > 0 && pop_invoked[latest[k - 1]] > pop_invoked[item] ? latest[k - 1] : item;
+    }
+
+    for (int b = 0; b < num_items; b++) {
+        if (push_invoked[b] < 0 || pop_returned[b] < 0 || pop_invoked[b] == LLONG_MAX)
+            continue;
+
+        int low = 0, high = num_pushed;
+
+        while (low < high) {
+            int middle = (low + high) / 2;
+
+            if (push_returned[order[middle]] < push_invoked[b])
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        if (low > 0 && pop_invoked[latest[low - 1]] > pop_returned[b]) {
+            int a = latest[low - 1];
+
+            if (!violations->reordered++ && !violations->example[0])
+                snprintf(violations->example, sizeof(violations->example), "item %d:%d was pushed before item %d:%d but popped after it", a / operations, a % operations, b / operations, b % operations);
+        }
+    }
+
+    // Capacity: count the items definitely in the buffer at every point in time.
+    int num_events = 0;
+
+    for (int i = 0; i < num_items; i++) {
+        if (push_returned[i] < 0 || (pop_invoked[i] >= 0 && pop_invoked[i] < push_returned[i]))
+            continue;
+
+        events[num_events][0] = push_returned[i];
+        events[num_events++][1] = 1;
+
+        if (pop_invoked[i] >= 0 && pop_invoked[i] != LLONG_MAX) {
+            events[num_events][0] = pop_invoked[i];
+            events[num_events++][1] = -1;
+        }
+    }
+
+    qsort(events, num_events, sizeof(events[0]), compareEvents);
+
+    int in_buffer = 0;
+
+    for (int i = 0; i < num_events; i++) {
+        in_buffer += (int)events[i][1];
+
+        if (in_buffer > violations->max_size)
+            violations->max_size = in_buffer;
+    }
+
+    if (violations->max_size > capacity && !violations->example[0])
+        snprintf(violations->example, sizeof(violations->example), "%d items were in a buffer of size %d at the same time", violations->max_size, capacity);
+
+    free(latest);
+    free(push_invoked);
+    free(push_returned);
+    free(pop_invoked);
+    free(pop_returned);
+    free(order);
+    free(events);
+}
+
+/**
+ * Runs a single stress round on a fresh buffer.
+ *
+ * @param test_case The test case providing the engine and buffer.
+ * @param operations The number of items pushed by each producer.
+ * @param num_producers The number of producers.
+ * @param num_consumers The number of consumers.
+ * @param violations Receives the violations found in the round's history.
+ */
+static void runRound(TestCase *test_case, int operations, int num_producers, int num_consumers, Violations *violations)
+{
+    int num_threads = num_producers + num_consumers;
+    StressThread *threads = (StressThread *)calloc(num_threads, sizeof(StressThread));
+    pthread_t *ids = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+    Stress stress = {test_case, operations, 0, (long)num_producers * operations, num_threads};
+
+    if (!threads || !ids) {
+        perror("malloc");
+        exit(1);
+    }
+
+    if (!queueInit(&test_case->queue, test_case->engine, test_case->BSIZE, sizeof(Item), &test_case->layout))
+        exit(1);
+
+    test_case->progress = 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        threads[i].id = i < num_producers ? i : i - num_producers;
+        threads[i].stress = &stress;
+        threads[i].seed = (unsigned int)rand();
+    }
+
+    for (int i = 0; i < num_threads; i++)
+        pthread_create(&ids[i], NULL, i < num_producers ? stressProduce : stressConsume, &threads[i]);
+
+    struct timespec deadline;
+    unsigned long last_progress = 0;
+    int idle = 0;
+
+    pthread_mutex_lock(&(test_case->done_lock));
+
+    while (stress.running > 0 && idle < STRESS_STALL) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += 1;
+
+        while (stress.running > 0 && pthread_cond_timedwait(&(test_case->done_flag), &(test_case->done_lock), &deadline) != ETIMEDOUT);
+
+        unsigned long progress = __atomic_load_n(&test_case->progress, __ATOMIC_RELAXED);
+
+        idle = progress == last_progress ? idle + 1 : 0;
+        last_progress = progress;
+    }
+
+    // A wedged round is terminated, waking its threads until every one of them has exited.
+    while (stress.running > 0) {
+        violations->wedged = true;
+
+        pthread_mutex_unlock(&(test_case->done_lock));
+        queueClose(&test_case->queue);
+        pthread_mutex_lock(&(test_case->done_lock));
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += 10000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+
+        pthread_cond_timedwait(&(test_case->done_flag), &(test_case->done_lock), &deadline);
+    }
+
+    pthread_mutex_unlock(&(test_case->done_lock));
+
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(ids[i], NULL);
+
+    check(threads, num_producers, num_consumers, operations, test_case->BSIZE, violations);
+
+    if (violations->wedged && !violations->example[0])
+        snprintf(violations->example, sizeof(violations->example), "the round stopped making progress after %ld pops were claimed", (long)num_producers * operations - (stress.remaining > 0 ? stress.remaining : 0));
+
+    for (int i = 0; i < num_threads; i++)
+        free(threads[i].history);
+
+    free(threads);
+    free(ids);
+
+    queueDestroy(&test_case->queue);
+}
+
+/**
+ * Runs the linearizability stress harness on a test case's engine and prints the outcome.
+ *
+ * The test case's sleep durations are ignored: threads only pause to perturb the
+ * interleaving.
+ *
+ * @param test_case_number The current test case number.
+ * @param rounds The number of rounds to run.
+ * @param operations The number of items pushed by each producer per round.
+ * @param num_producers The number of producers.
+ * @param num_consumers The number of consumers.
+ * @param test_case The structure holding the test case parameters.
+ */
+void stress(int test_case_number, int rounds, int operations, int num_producers, int num_consumers, TestCase *test_case)
+{
+    printf("Stress Test Case %d\n", test_case_number);
+    printf("\tbufferSize = %d, num_producers = %d, num_consumers = %d, engine = %s, rounds = %d, operations = %d \n", test_case->BSIZE, num_producers, num_consumers, test_case->engine->name, rounds, operations);
+
+    if (num_producers <= 0 || num_consumers <= 0 || operations <= 0) {
+        printf("\tNothing to stress\n");
+        return;
+    }
+
+    // Coalesced and dropped items legitimately vanish, which the harness would report as lost.
+    if (test_case->engine->coalescing || test_case->engine->dropping) {
+        printf("\tThe stress harness does not apply to coalescing or dropping engines\n");
+        return;
+    }
+
+    pthread_condattr_t done_flag_attr;
+    pthread_condattr_init(&done_flag_attr);
+    pthread_condattr_setclock(&done_flag_attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&(test_case->done_lock), NULL);
+    pthread_cond_init(&(test_case->done_flag), &done_flag_attr);
+    pthread_condattr_destroy(&done_flag_attr);
+
+    int passed = 0;
+    int reported = 0;
+
+    int run = 0;
+
+    // SIGINT stops the harness after the current round.
+    for (int round = 1; round <= rounds && !stopRequested(); round++, run++) {
+        Violations violations;
+
+        memset(&violations, 0, sizeof(violations));
+        runRound(test_case, operations, num_producers, num_consumers, &violations);
+
+        if (!violations.wedged && !violations.fresh && !violations.repeated && !violations.reordered && !violations.lost && violations.max_size <= test_case->BSIZE) {
+            passed++;
+            continue;
+        }
+
+        if (reported++ < MAX_REPORTED_ROUNDS)
+            printf("\tRound %d: %swedged, fresh = %lu, repeated = %lu, reordered = %lu, lost = %lu, max size = %d (e.g. %s)\n",
+                   round, violations.wedged ? "" : "not ", violations.fresh, violations.repeated, violations.reordered, violations.lost, violations.max_size, violations.example);
+    }
+
+    pthread_mutex_destroy(&(test_case->done_lock));
+    pthread_cond_destroy(&(test_case->done_flag));
+
+    printf("\tLinearizability: %d/%d rounds passed (%s)%s\n", passed, run, passed == run ? "PASS" : "FAIL", run < rounds ? " (interrupted)" : "");
+}
@@ -0,0 +1,275 @@
+/**
+ * Thread spawning: a test case may set the stack and guard sizes of its producer and
+ * consumer threads, so that rows with thousands of threads do not reserve the default
+ * stack (usually 8 MiB) for each of them. The time taken to spawn the threads and the
+ * virtual and resident memory they added to the process are measured and reported per
+ * thread.
+ *
+ * A test case may also set the scheduling policy and nice level of its producers and of its
+ * consumers, e.g. to see whether deprioritizing bulk producers protects the consumers'
+ * latency. Every thread applies its group's settings to itself as it starts; a policy or
+ * nice level the system refuses (typically a real-time policy or a negative nice level
+ * without the privilege) leaves the thread on the default one and is reported.
+ *
+ * @author Nicholas Adamou
+ * @date 12/7/2019
+ */
+
+#define _GNU_SOURCE // SCHED_BATCH and SCHED_IDLE.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "simulator.h"
+
+/**
+ * Reads the virtual and resident memory of the process.
+ *
+ * @param virtual_bytes Receives the size of the address space in bytes (0 if unknown).
+ * @param resident_bytes Receives the resident set size in bytes (0 if unknown).
+ */
+void processMemory(size_t *virtual_bytes, size_t *resident_bytes)
+{
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm) {
+        if (fscanf(statm, "%lu %lu", &size, &resident) != 2)
+            size = resident = 0;
+
+        fclose(statm);
+    }
+
+    *virtual_bytes = (size_t)size * (size_t)sysconf(_SC_PAGESIZE);
+    *resident_bytes = (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Prepares the attributes of a test case's producer and consumer threads, keeping the
+ * default size of any stack or guard the system rejects.
+ *
+ * @param test_case The test case.
+ * @param attr Receives the attributes, to be destroyed by the caller.
+ */
+void initThreadAttributes(const TestCase *test_case, pthread_attr_t *attr)
+{
+    int error;
+
+    pthread_attr_init(attr);
+
+    if (test_case->stack_size && (error = pthread_attr_setstacksize(attr, test_case->stack_size)) != 0)
+        printf("\tstack = %zu bytes rejected (%s), using the default\n", test_case->stack_size, strerror(error));
+
+    if (test_case->guard_size >= 0 && (error = pthread_attr_setguardsize(attr, (size_t)test_case->guard_size)) != 0)
+        printf("\tguard = %ld bytes rejected (%s), using the default\n", test_case->guard_size, strerror(error));
+}
+
+/**
+ * Starts measuring the spawning of a test case's threads.
+ *
+ * @param test_case The test case.
+ */
+void beginSpawn(TestCase *test_case)
+{
+    ThreadSpawn *spawn = &test_case->spawn;
+
+    memset(spawn, 0, sizeof(ThreadSpawn));
+
+    test_case->producer_schedule.rejected = test_case->producer_schedule.nice_rejected = 0;
+    test_case->consumer_schedule.rejected = test_case->consumer_schedule.nice_rejected = 0;
+    processMemory(&spawn->virtual_bytes, &spawn->resident_bytes);
+    spawn->elapsed = now();
+}
+
+/**
+ * Finishes measuring the spawning of a test case's threads.
+ *
+ * @param test_case The test case.
+ * @param attr The attributes the threads were created with.
+ * @param spawned The number of threads created.
+ * @param failed The number of threads that could not be created.
+ */
+void endSpawn(TestCase *test_case, const pthread_attr_t *attr, int spawned, int failed)
+{
+    ThreadSpawn *spawn = &test_case->spawn;
+    size_t virtual_bytes;
+    size_t resident_bytes;
+
+    spawn->elapsed = now() - spawn->elapsed;
+    processMemory(&virtual_bytes, &resident_bytes);
+
+    spawn->virtual_bytes = virtual_bytes - spawn->virtual_bytes;
+    spawn->resident_bytes = resident_bytes - spawn->resident_bytes;
+    spawn->threads = spawned;
+    spawn->failed = failed;
+
+    pthread_attr_getstacksize(attr, &spawn->stack_size);
+    pthread_attr_getguardsize(attr, &spawn->guard_size);
+}
+
+/**
+ * Reads the name of a scheduling policy.
+ *
+ * @param name The name, as given by the 'producer_sched' and 'consumer_sched' options.
+ * @param policy Receives the policy.
+ *
+ * @return Whether the name is known.
+ */
+bool parseSchedulePolicy(const char *name, int *policy)
+{
+    static const struct { const char *name; int policy; } policies[] = {
+        {"other", SCHED_OTHER}, {"batch", SCHED_BATCH}, {"idle", SCHED_IDLE}, {"fifo", SCHED_FIFO}, {"rr", SCHED_RR}
+    };
+
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(name, policies[i].name) == 0) {
+            *policy = policies[i].policy;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Names a scheduling policy.
+ *
+ * @param policy The policy.
+ *
+ * @return Its name, as given by the 'producer_sched' and 'consumer_sched' options.
+ */
+const char *schedulePolicyName(int policy)
+{
+    switch (policy) {
+        case SCHED_BATCH: return "batch";
+        case SCHED_IDLE: return "idle";
+        case SCHED_FIFO: return "fifo";
+        case SCHED_RR: return "rr";
+    }
+
+    return "other";
+}
+
+/**
+ * Determines whether a group of threads has any scheduling setting other than the default.
+ *
+ * @param schedule The group's scheduling settings.
+ *
+ * @return Whether the threads must apply them.
+ */
+bool scheduleSet(const ThreadSchedule *schedule)
+{
+    return schedule->policy != SCHED_OTHER || schedule->nice;
+}
+
+/**
+ * Validates a group's scheduling settings, giving a real-time policy without a priority the
+ * lowest one.
+ *
+ * @param schedule The group's scheduling settings.
+ *
+ * @return NULL if they are valid, or why they are not.
+ */
+const char *checkSchedule(ThreadSchedule *schedule)
+{
+    bool real_time = schedule->policy == SCHED_FIFO || schedule->policy == SCHED_RR;
+
+    if (schedule->nice < -20 || schedule->nice > 19)
+        return "nice must be between -20 and 19";
+
+    if (!real_time && schedule->priority)
+        return "a priority needs the fifo or rr policy";
+
+    if (real_time && !schedule->priority)
+        schedule->priority = sched_get_priority_min(schedule->policy);
+
+    if (real_time && (schedule->priority < sched_get_priority_min(schedule->policy) || schedule->priority > sched_get_priority_max(schedule->policy)))
+        return "priority is out of the policy's range";
+
+    return NULL;
+}
+
+/**
+ * Applies the scheduling settings of a worker's group to the calling thread, which is the
+ * worker's thread. Refused settings are counted and the thread keeps the default ones.
+ *
+ * @param worker The producer or consumer.
+ */
+void applySchedule(Worker *worker)
+{
+    TestCase *test_case = worker->test_case;
+    ThreadSchedule *schedule = worker->is_producer ? &test_case->producer_schedule : &test_case->consumer_schedule;
+
+    if (schedule->policy != SCHED_OTHER) {
+        struct sched_param param = {0};
+        param.sched_priority = schedule->priority;
+
+        int error = pthread_setschedparam(pthread_self(), schedule->policy, &param);
+
+        if (error) {
+            __atomic_add_fetch(&schedule->rejected, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&schedule->policy_error, error, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Linux keeps a nice level per thread, which the calling thread sets through its thread id.
+    if (schedule->nice && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), schedule->nice) != 0) {
+        __atomic_add_fetch(&schedule->nice_rejected, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&schedule->nice_error, errno, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Prints a group's scheduling settings and any the system refused.
+ */
+static void reportSchedule(const char *group, const ThreadSchedule *schedule)
+{
+    printf("%s = %s", group, schedulePolicyName(schedule->policy));
+
+    if (schedule->policy == SCHED_FIFO || schedule->policy == SCHED_RR)
+        printf(" %d", schedule->priority);
+
+    if (schedule->nice)
+        printf(", nice %d", schedule->nice);
+
+    if (schedule->rejected)
+        printf(" (policy refused to %d threads: %s, left on other)", schedule->rejected, strerror(schedule->policy_error));
+
+    if (schedule->nice_rejected)
+        printf(" (nice refused to %d threads: %s, left at 0)", schedule->nice_rejected, strerror(schedule->nice_error));
+}
+
+/**
+ * Prints how long a test case's threads took to spawn and the memory they added.
+ *
+ * @param test_case The finished test case.
+ */
+void reportThreads(TestCase *test_case)
+{
+    ThreadSpawn *spawn = &test_case->spawn;
+    int threads = spawn->threads ? spawn->threads : 1;
+
+    printf("\tThreads: %d spawned in %.3f ms (%.1f us each), stack = %zu KiB, guard = %zu KiB, virtual memory +%.1f KiB and resident set +%.1f KiB per thread",
+           spawn->threads, spawn->elapsed / 1e6, spawn->elapsed / 1e3 / threads, spawn->stack_size / 1024, spawn->guard_size / 1024,
+           (double)(ptrdiff_t)spawn->virtual_bytes / 1024 / threads, (double)(ptrdiff_t)spawn->resident_bytes / 1024 / threads);
+
+    if (spawn->failed)
+        printf(", %d could not be created", spawn->failed);
+
+    printf("\n");
+
+    if (!scheduleSet(&test_case->producer_schedule) && !scheduleSet(&test_case->consumer_schedule))
+        return;
+
+    printf("\tScheduling: ");
+    reportSchedule("producers", &test_case->producer_schedule);
+    printf(", ");
+    reportSchedule("consumers", &test_case->consumer_schedule);
+    printf("\n");
+}